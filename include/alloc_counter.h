@@ -0,0 +1,19 @@
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include <cstdint>
+
+// Heap allocation counter for checking that the search stays allocation
+// free. Only active in builds configured with DEEPSQUARE_COUNT_ALLOCS, which
+// replaces the global operator new; otherwise count() is always zero.
+namespace AllocCounter {
+#if defined(DEEPSQUARE_COUNT_ALLOCS)
+    uint64_t count();
+    constexpr bool enabled = true;
+#else
+    inline uint64_t count() { return 0; }
+    constexpr bool enabled = false;
+#endif
+}
+
+#endif
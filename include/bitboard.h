@@ -0,0 +1,216 @@
+#ifndef BITBOARD_H
+#define BITBOARD_H
+
+#include "piece.h"
+#include <array>
+#include <cstdint>
+
+#if defined(_MSC_VER)
+    #include <intrin.h>
+#endif
+
+#if defined(__BMI2__) || (defined(_MSC_VER) && defined(__AVX2__) && defined(_M_X64))
+    #include <immintrin.h>
+    #define HAS_PEXT 1
+#endif
+
+// Squares are numbered y * 8 + x, so a1 = 0, h1 = 7 and h8 = 63.
+using Bitboard = uint64_t;
+
+constexpr int NO_SQUARE = 64;
+
+constexpr Bitboard FILE_A_BB = 0x0101010101010101ULL;
+constexpr Bitboard FILE_H_BB = FILE_A_BB << 7;
+constexpr Bitboard RANK_1_BB = 0xFFULL;
+constexpr Bitboard RANK_8_BB = RANK_1_BB << 56;
+
+constexpr Bitboard squareBB(int square) { return 1ULL << square; }
+constexpr int makeSquare(int x, int y) { return y * 8 + x; }
+constexpr int fileOf(int square) { return square & 7; }
+constexpr int rankOf(int square) { return square >> 3; }
+
+inline int popCount(Bitboard b) {
+#if defined(_MSC_VER)
+    return static_cast<int>(__popcnt64(b));
+#else
+    return __builtin_popcountll(b);
+#endif
+}
+
+inline int lsb(Bitboard b) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, b);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(b);
+#endif
+}
+
+inline int popLsb(Bitboard& b) {
+    int square = lsb(b);
+    b &= b - 1;
+    return square;
+}
+
+inline bool moreThanOne(Bitboard b) { return (b & (b - 1)) != 0; }
+
+namespace Bitboards {
+
+// Leaper, between and line tables only depend on board geometry, so they are
+// built by the compiler and cost nothing at startup.
+namespace detail {
+
+constexpr Bitboard rayAttacks(int square, Bitboard occupied, int dx, int dy) {
+    Bitboard attacks = 0;
+    int x = fileOf(square) + dx;
+    int y = rankOf(square) + dy;
+    while(x >= 0 && x < 8 && y >= 0 && y < 8) {
+        attacks |= squareBB(makeSquare(x, y));
+        if(occupied & squareBB(makeSquare(x, y))) break;
+        x += dx;
+        y += dy;
+    }
+    return attacks;
+}
+
+constexpr Bitboard slidingAttacks(PieceType type, int square, Bitboard occupied) {
+    Bitboard attacks = 0;
+    if(type != ROOK) {
+        attacks |= rayAttacks(square, occupied, 1, 1) | rayAttacks(square, occupied, 1, -1)
+                 | rayAttacks(square, occupied, -1, 1) | rayAttacks(square, occupied, -1, -1);
+    }
+    if(type != BISHOP) {
+        attacks |= rayAttacks(square, occupied, 1, 0) | rayAttacks(square, occupied, -1, 0)
+                 | rayAttacks(square, occupied, 0, 1) | rayAttacks(square, occupied, 0, -1);
+    }
+    return attacks;
+}
+
+constexpr Bitboard stepAttacks(int square, const int (&steps)[8][2]) {
+    Bitboard attacks = 0;
+    for(int i = 0; i < 8; i++) {
+        int x = fileOf(square) + steps[i][0];
+        int y = rankOf(square) + steps[i][1];
+        if(x >= 0 && x < 8 && y >= 0 && y < 8) {
+            attacks |= squareBB(makeSquare(x, y));
+        }
+    }
+    return attacks;
+}
+
+constexpr int knightSteps[8][2] = {{1, 2}, {2, 1}, {2, -1}, {1, -2}, {-1, -2}, {-2, -1}, {-2, 1}, {-1, 2}};
+constexpr int kingSteps[8][2] = {{1, 0}, {1, 1}, {0, 1}, {-1, 1}, {-1, 0}, {-1, -1}, {0, -1}, {1, -1}};
+
+constexpr std::array<Bitboard, 64> makeStepTable(const int (&steps)[8][2]) {
+    std::array<Bitboard, 64> table{};
+    for(int square = 0; square < 64; square++) {
+        table[square] = stepAttacks(square, steps);
+    }
+    return table;
+}
+
+constexpr std::array<std::array<Bitboard, 64>, 2> makePawnTable() {
+    std::array<std::array<Bitboard, 64>, 2> table{};
+    for(int square = 0; square < 64; square++) {
+        Bitboard b = squareBB(square);
+        table[WHITE][square] = ((b & ~FILE_A_BB) << 7) | ((b & ~FILE_H_BB) << 9);
+        table[BLACK][square] = ((b & ~FILE_A_BB) >> 9) | ((b & ~FILE_H_BB) >> 7);
+    }
+    return table;
+}
+
+// lineTable[a][b] is the full rank, file or diagonal through a and b;
+// betweenTable[a][b] holds the squares strictly between them. Both are
+// empty when the squares are not aligned.
+constexpr std::array<std::array<Bitboard, 64>, 64> makeLineTable(bool between) {
+    std::array<std::array<Bitboard, 64>, 64> table{};
+    for(int a = 0; a < 64; a++) {
+        for(PieceType type : {BISHOP, ROOK}) {
+            Bitboard rays = slidingAttacks(type, a, 0);
+            for(int b = 0; b < 64; b++) {
+                if(!(rays & squareBB(b))) continue;
+                if(between) {
+                    table[a][b] = slidingAttacks(type, a, squareBB(b)) & slidingAttacks(type, b, squareBB(a));
+                } else {
+                    table[a][b] = (rays & slidingAttacks(type, b, 0)) | squareBB(a) | squareBB(b);
+                }
+            }
+        }
+    }
+    return table;
+}
+
+} // namespace detail
+
+inline constexpr std::array<std::array<Bitboard, 64>, 2> pawnAttackTable = detail::makePawnTable();
+inline constexpr std::array<Bitboard, 64> knightAttackTable = detail::makeStepTable(detail::knightSteps);
+inline constexpr std::array<Bitboard, 64> kingAttackTable = detail::makeStepTable(detail::kingSteps);
+inline constexpr std::array<std::array<Bitboard, 64>, 64> lineTable = detail::makeLineTable(false);
+inline constexpr std::array<std::array<Bitboard, 64>, 64> betweenTable = detail::makeLineTable(true);
+
+// Fixed-shift magic (or PEXT) lookup for one square of one slider type.
+struct Magic {
+    Bitboard mask;
+    Bitboard magic;
+    const Bitboard* attacks;
+    unsigned shift;
+
+    unsigned index(Bitboard occupied) const;
+};
+
+extern Magic rookMagics[64];
+extern Magic bishopMagics[64];
+extern bool usePext;
+
+// Fills the slider tables. Picks PEXT indexing when the binary was built with
+// BMI2 and the CPU executes PEXT natively (AMD before Zen 3 microcodes it).
+void init();
+long long initMicros();
+const char* sliderIndexing();
+
+inline unsigned Magic::index(Bitboard occupied) const {
+#if defined(HAS_PEXT)
+    if(usePext) {
+        return static_cast<unsigned>(_pext_u64(occupied, mask));
+    }
+#endif
+    return static_cast<unsigned>(((occupied & mask) * magic) >> shift);
+}
+
+inline Bitboard pawnAttacks(Color color, int square) { return pawnAttackTable[color][square]; }
+inline Bitboard knightAttacks(int square) { return knightAttackTable[square]; }
+inline Bitboard kingAttacks(int square) { return kingAttackTable[square]; }
+inline Bitboard between(int a, int b) { return betweenTable[a][b]; }
+inline Bitboard line(int a, int b) { return lineTable[a][b]; }
+inline bool aligned(int a, int b, int c) { return (lineTable[a][b] & squareBB(c)) != 0; }
+
+inline Bitboard bishopAttacks(int square, Bitboard occupied) {
+    const Magic& m = bishopMagics[square];
+    return m.attacks[m.index(occupied)];
+}
+
+inline Bitboard rookAttacks(int square, Bitboard occupied) {
+    const Magic& m = rookMagics[square];
+    return m.attacks[m.index(occupied)];
+}
+
+inline Bitboard queenAttacks(int square, Bitboard occupied) {
+    return bishopAttacks(square, occupied) | rookAttacks(square, occupied);
+}
+
+// Attacks of a non-pawn piece.
+inline Bitboard attacks(PieceType type, int square, Bitboard occupied) {
+    switch(type) {
+        case KNIGHT: return knightAttacks(square);
+        case BISHOP: return bishopAttacks(square, occupied);
+        case ROOK: return rookAttacks(square, occupied);
+        case QUEEN: return queenAttacks(square, occupied);
+        case KING: return kingAttacks(square);
+        default: return 0;
+    }
+}
+
+} // namespace Bitboards
+
+#endif
@@ -2,19 +2,102 @@
 #define BOARD_H
 
 #include "piece.h"
+#include "bitboard.h"
+#include "move.h"
 #include <vector>
 #include <string>
 
+constexpr int MAX_PLY = 128;
+
+enum CastlingRights : uint8_t {
+    NO_CASTLING = 0,
+    WHITE_OO = 1,
+    WHITE_OOO = 2,
+    BLACK_OO = 4,
+    BLACK_OOO = 8,
+    ALL_CASTLING = 15
+};
+
+// Everything doMove() cannot recompute when the move is taken back.
+struct StateInfo {
+    uint64_t key;
+    uint64_t pawnKey;
+    uint64_t materialKey;
+    Bitboard checkers;
+    Piece captured;
+    uint8_t castlingRights;
+    uint8_t epSquare;
+    uint8_t halfmoveClock;
+    uint8_t pliesFromNull;
+};
+
 class Board {
 private:
-    Piece board[8][8];
+    Bitboard byType[KING + 1];
+    Bitboard byColor[2];
+    Piece mailbox[64];
+    uint8_t kingSquare[2];
     bool whiteToMove;
-    
+    int stateIndex;
+    StateInfo states[MAX_PLY + 1];
+
+    // Keys of the game and search line so far. repetition is the distance
+    // back to the same position, negated once the position occurs a third
+    // time, so draw checks in the search are a single lookup.
+    struct KeyHistoryEntry {
+        uint64_t key;
+        int repetition;
+    };
+    static constexpr int KEY_HISTORY_SIZE = 512;
+    KeyHistoryEntry keyHistory[KEY_HISTORY_SIZE];
+    int gamePly;
+
+    void clear();
+    void computeKeys();
+    void computeCheckers();
+    void pushKeyHistory();
+    void putPiece(Piece piece, int square);
+    void removePiece(int square);
+    void movePiece(int from, int to);
+    PieceType leastValuableAttacker(Bitboard attackers, Color side, int& square) const;
+
 public:
     Board();
     void initialize();
     Piece getPiece(int x, int y) const;
+    Piece getPiece(int square) const { return mailbox[square]; }
+    Bitboard getPieces(PieceType type) const { return byType[type]; }
+    Bitboard getPieces(Color color) const { return byColor[color]; }
+    Bitboard getPieces(PieceType type, Color color) const { return byType[type] & byColor[color]; }
+    Bitboard getOccupied() const { return byColor[WHITE] | byColor[BLACK]; }
+    int getKingSquare(Color color) const { return kingSquare[color]; }
+    Color getSideToMove() const { return whiteToMove ? WHITE : BLACK; }
+    int getCastlingRights() const { return states[stateIndex].castlingRights; }
+    int getEpSquare() const { return states[stateIndex].epSquare; }
+    int getHalfmoveClock() const { return states[stateIndex].halfmoveClock; }
+    int getGamePly() const { return gamePly; }
+    uint64_t getKey() const { return states[stateIndex].key; }
+    uint64_t getPawnKey() const { return states[stateIndex].pawnKey; }
+    uint64_t getMaterialKey() const { return states[stateIndex].materialKey; }
+    Bitboard getCheckers() const { return states[stateIndex].checkers; }
+    bool isDraw(int ply) const;
+    Bitboard attackersTo(int square, Bitboard occupied) const;
+    Bitboard pieceTargets(int square) const;
+    bool isSquareAttacked(int square, Color attacker) const;
+    bool isLegal(Move move) const;
+    bool isPseudoLegal(Move move) const;
+    bool givesCheck(Move move) const;
+    int see(Move move) const;
+    bool seeGe(Move move, int threshold) const;
+    bool isCapture(Move move) const {
+        return mailbox[move.getTo()].getType() != EMPTY || move.getFlag() == EN_PASSANT;
+    }
     bool makeMove(int fromX, int fromY, int toX, int toY, PieceType promotion = EMPTY);
+    void doMove(Move move);
+    void undoMove(Move move);
+    // Passes the turn; only valid when the side to move is not in check
+    void doNullMove();
+    void undoNullMove();
     bool isCheck() const;
     bool isCheckmate() const;
     bool isWhiteToMove() const { return whiteToMove; }
@@ -22,4 +105,4 @@ public:
     std::vector<std::pair<int, int>> getLegalMoves(int x, int y) const;
 };
 
-#endif 
\ No newline at end of file
+#endif
@@ -0,0 +1,47 @@
+#ifndef BOOK_H
+#define BOOK_H
+
+#include "board.h"
+#include "move.h"
+#include <cstdint>
+#include <random>
+#include <string>
+
+// Polyglot opening book. The .bin file is a sorted array of 16-byte
+// big-endian entries (key, move, weight, learn) and is memory-mapped
+// read-only, so opening is instant whatever its size and the pages are
+// shared with other engine processes using the same book.
+class Book {
+private:
+    const uint8_t* entries;
+    size_t entryCount;
+    void* baseAddress;
+    uint64_t mapping;
+    int maxMoves;
+    bool bestMove;
+    std::mt19937 rng;
+
+public:
+    static constexpr int MAX_DEPTH = 255;
+
+    Book();
+    ~Book();
+    Book(const Book&) = delete;
+    Book& operator=(const Book&) = delete;
+
+    // "" or "<empty>" closes the book; returns false if nothing was opened
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const { return entries != nullptr; }
+
+    // Book moves are played for the first moves of the game only
+    void setDepth(int moves) { maxMoves = moves; }
+    // Always play the highest weighted move instead of a weighted pick
+    void setBestMove(bool best) { bestMove = best; }
+
+    static uint64_t polyglotKey(const Board& board);
+    // A legal book move for the position, or a null move
+    Move probe(const Board& board);
+};
+
+#endif
@@ -3,28 +3,148 @@
 
 #include "board.h"
 #include "move.h"
+#include "movepick.h"
 #include "nnue.h"
+#include "numa.h"
+#include "timeman.h"
+#include "tt.h"
 #include <vector>
+#include <algorithm>
 #include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 
 class Engine {
+public:
+    static constexpr int INFINITE_SCORE = 32000;
+    static constexpr int MATE_SCORE = 30000;
+    // Slack over the captured piece's value before qsearch gives up on a capture
+    static constexpr int DELTA_MARGIN = 200;
+    // Marks a TT entry stored without a static evaluation
+    static constexpr int NO_EVAL = INFINITE_SCORE + 1;
+    // Depth recorded for quiescence results; any main-search depth beats it
+    static constexpr int DEPTH_QS = 0;
+    // Initial half-width of the root aspiration window
+    static constexpr int ASPIRATION_WINDOW = 25;
+
 private:
-    struct SearchInfo {
-        uint64_t nodes;
+    // Per-ply search state; entry ply + 2 belongs to ply, so the two
+    // entries in front of the root can be read as sentinels
+    struct SearchStack {
+        Move currentMove;
+        Move killers[2];
+        PieceToHistory* continuation;
+        bool nullMoved;
+    };
+
+    // One MultiPV line with the score it was searched to
+    struct RootLine {
+        int score;
+        int length;
+        Move pv[MAX_PLY + 1];
+    };
+
+    // Everything one search thread owns. Lazy SMP threads share only the
+    // transposition table; each searches its own copy of the root. The
+    // counters are written by the owner alone and summed for reporting,
+    // and the alignment keeps them off other threads' cache lines.
+    struct alignas(64) SearchInfo {
+        std::atomic<uint64_t> nodes;
+        std::atomic<uint64_t> qnodes;
+        std::atomic<uint64_t> evalProbes;
+        std::atomic<uint64_t> evalHits;
+        uint64_t allocations;
+        int id;
         int depth;
         std::vector<Move> pv;
         int score;
+        int pollCountdown;
+        // Null moves are disabled above this ply while a verification runs
+        int nullMinPly;
+        Move bestMove;
+        Board rootBoard;
+        MoveList rootMoves;
+        std::vector<RootLine> lines;
+        NNUE evaluator;
+        // Direct-mapped static evals: the upper 48 key bits above the score
+        std::unique_ptr<uint64_t[]> evalCache;
+        size_t evalCacheMask;
+        std::unique_ptr<SearchHistory> history;
+        SearchStack stack[MAX_PLY + 4];
+        // Triangular PV: row ply holds the best line found from ply on
+        Move pvTable[MAX_PLY + 1][MAX_PLY + 1];
+        int pvLength[MAX_PLY + 1];
+        
+        void countNode(std::atomic<uint64_t>& counter) {
+            counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
     };
 
+    // Selectivity parameters; margins are in centipawns, LMR terms in
+    // hundredths
+    struct SearchParams {
+        int nullMinDepth = 3;
+        int nullReduction = 3;
+        int nullDepthDivisor = 3;
+        int nullVerifyDepth = 12;
+        int lmrBase = 75;
+        int lmrDivisor = 225;
+        int lmrMinDepth = 3;
+        int lmrMinMoves = 3;
+        int rfpMaxDepth = 7;
+        int rfpMargin = 80;
+        int futilityMaxDepth = 6;
+        int futilityBase = 100;
+        int futilityMargin = 100;
+        int lmpMaxDepth = 6;
+        int lmpBase = 3;
+        int seeMaxDepth = 3;
+        int seeQuietMargin = 30;
+        int seeCaptureMargin = 100;
+        int checkExtension = 1;
+    };
+    
+    SearchParams params;
+    // Late move reductions in plies by [depth][move number]
+    int reductions[64][64];
+    
+    int defaultDepth;
     int searchDepth;
-    int moveTime;
-    int timeWhite;
-    int timeBlack;
-    int incrementWhite;
-    int incrementBlack;
+    SearchLimits limits;
+    TimeManager timeManager;
+    int moveOverhead;
     std::atomic<bool> stopSearch;
+    // Set by "go ponder" until ponderhit; no time limit applies meanwhile
+    std::atomic<bool> pondering;
+    // The soft limit passed while pondering
+    std::atomic<bool> stopOnPonderhit;
+    Move ponderMove;
     NNUE evaluator;
+    TranspositionTable tt;
+    Numa::Policy numaPolicy;
+    // NUMA node per search thread; empty when threads are not bound
+    std::vector<int> threadNodes;
+    
+    // searchInfos[0] belongs to the thread calling getBestMove; the others
+    // to persistent helpers that sleep between searches
+    std::vector<std::unique_ptr<SearchInfo>> searchInfos;
+    std::vector<std::thread> helpers;
+    std::mutex poolMutex;
+    std::condition_variable poolCondition;
+    uint64_t searchGeneration;
+    int helpersRunning;
+    bool poolExit;
+    
+    // Perft results keyed by position and depth; empty unless PerftHash is set
+    struct PerftEntry {
+        std::atomic<uint64_t> check;
+        std::atomic<uint64_t> data;
+    };
+    std::unique_ptr<PerftEntry[]> perftTable;
+    size_t perftTableMask;
     
     // New members for UCI options
     int hashSize;
@@ -33,30 +153,64 @@ private:
     int skillLevel;
     bool ponderEnabled;
     bool debugMode;
+    bool neverClearHash;
+    int evalCacheSize;
     
 public:
     Engine(int depth = 4);
+    ~Engine();
     Move getBestMove(const Board& board);
-    void setSearchParams(int depth, int movetime, int wtime, int btime, int winc, int binc);
-    void stopSearching() { stopSearch = true; }
+    void setSearchParams(const SearchLimits& searchLimits);
+    void setMoveOverhead(int ms) { moveOverhead = ms; }
+    void stopSearching();
+    void ponderHit();
+    // The reply expected after the last best move, if the PV had one
+    Move getPonderMove() const { return ponderMove; }
     bool isStopRequested() const { return stopSearch; }
     
     // New UCI option methods
     void clearTables();
-    void setHashSize(int size) { hashSize = size; }
-    void setThreadCount(int count) { threadCount = count; }
-    void setMultiPV(int mpv) { multiPV = mpv; }
+    void setHashSize(int size);
+    // Keeps the transposition table across ucinewgame, for analysis
+    void setNeverClearHash(bool enable) { neverClearHash = enable; }
+    bool saveHash(const std::string& filename) const { return tt.save(filename); }
+    bool loadHash(const std::string& filename);
+    void setThreadCount(int count);
+    void setNumaPolicy(const std::string& policy);
+    // Per-thread eval cache in MB, 0 to disable
+    void setEvalCacheSize(int megabytes);
+    void setMultiPV(int mpv) { multiPV = std::max(1, mpv); }
     void setSkillLevel(int level) { skillLevel = level; }
     void setPonder(bool enable) { ponderEnabled = enable; }
     void setDebugMode(bool enable) { debugMode = enable; }
+    void setPerftHashSize(int megabytes);
+    bool setSearchParam(const std::string& name, const std::string& value);
+    
+    // Prints the node count below each root move and returns the total
+    uint64_t divide(const Board& board, int depth);
     
 private:
-    int minimax(Board& board, int depth, int alpha, int beta, bool maximizing, SearchInfo& info);
-    std::vector<Move> generateAllMoves(const Board& board, bool forWhite);
-    bool isTimeUp();
-    void orderMoves(std::vector<Move>& moves, const Board& board);
+    int minimax(Board& board, int depth, int ply, int alpha, int beta, SearchInfo& info);
+    int qsearch(Board& board, int ply, int alpha, int beta, SearchInfo& info);
+    void initReductions();
+    void iterativeDeepening(SearchInfo& info);
+    int searchRoot(SearchInfo& info, int depth, int firstMove, int alpha, int beta);
+    void updatePV(SearchInfo& info, int ply, Move move);
+    void helperLoop(int id);
+    void stopHelpers();
+    void allocateEvalCache(SearchInfo& info);
+    int evaluate(const Board& board, SearchInfo& info);
+    void generateAllMoves(const Board& board, MoveList& moves);
+    bool isTimeUp() const { return stopSearch.load(std::memory_order_relaxed); }
+    void pollTime(SearchInfo& info);
+    uint64_t totalNodes() const;
+    void printLines(const SearchInfo& info, int pvCount);
+    void orderMoves(MoveList& moves, const Board& board);
+    void updateQuietStats(const Board& board, SearchInfo& info, SearchStack* ss, Move move,
+                          const Move* quietsTried, int quietCount, int depth);
+    void updateContinuation(const Board& board, SearchInfo& info, SearchStack* ss, Move move, int bonus);
     uint64_t perft(Board& board, int depth);
-    std::string moveToString(const Move& move);
+    std::string moveToString(Move move);
 };
 
 #endif 
\ No newline at end of file
@@ -5,7 +5,7 @@
 
 class Evaluation {
 public:
-    static int evaluatePosition(const Board& board);
+    static int evaluateMaterial(const Board& board);
     static int getPieceValue(const Piece& piece);
     static int getPositionalValue(const Piece& piece, int x, int y);
 };
@@ -2,17 +2,70 @@
 #define MOVE_H
 
 #include "piece.h"
+#include <cstdint>
+#include <string>
 
-struct Move {
-    int fromX;
-    int fromY;
-    int toX;
-    int toY;
-    PieceType promotion;
-    int score;
-    
-    Move(int fx = 0, int fy = 0, int tx = 0, int ty = 0, int s = 0);
-    bool operator<(const Move& other) const;
+enum MoveFlag : uint16_t {
+    NORMAL = 0,
+    PROMOTION = 1 << 14,
+    EN_PASSANT = 2 << 14,
+    CASTLING = 3 << 14
 };
 
-#endif 
\ No newline at end of file
+// A move packed into 16 bits: destination in bits 0-5, origin in bits 6-11,
+// promotion piece (knight to queen) in bits 12-13 and the flag on top.
+// Move() is the null move.
+class Move {
+private:
+    uint16_t data;
+
+public:
+    Move() : data(0) {}
+    Move(int from, int to, MoveFlag flag = NORMAL, PieceType promotion = KNIGHT)
+        : data(static_cast<uint16_t>(flag | ((promotion - KNIGHT) << 12) | (from << 6) | to)) {}
+
+    int getFrom() const { return (data >> 6) & 0x3F; }
+    int getTo() const { return data & 0x3F; }
+    MoveFlag getFlag() const { return static_cast<MoveFlag>(data & (3 << 14)); }
+    PieceType getPromotion() const {
+        return getFlag() == PROMOTION ? static_cast<PieceType>(((data >> 12) & 3) + KNIGHT) : EMPTY;
+    }
+    uint16_t getRaw() const { return data; }
+    static Move fromRaw(uint16_t raw) {
+        Move move;
+        move.data = raw;
+        return move;
+    }
+    bool isNull() const { return data == 0; }
+    std::string toString() const;
+
+    bool operator==(const Move& other) const { return data == other.data; }
+    bool operator!=(const Move& other) const { return data != other.data; }
+};
+
+// Fixed-capacity move buffer that lives on the stack of each search node.
+// Scores are kept in a parallel array so Move stays two bytes.
+struct MoveList {
+    static constexpr int CAPACITY = 256;
+
+    Move moves[CAPACITY];
+    int scores[CAPACITY];
+    int count = 0;
+
+    void add(Move move) { moves[count++] = move; }
+    int size() const { return count; }
+    bool empty() const { return count == 0; }
+    void clear() { count = 0; }
+    bool contains(Move move) const;
+    void moveToFront(Move move, int first = 0);
+    void sortByScore();
+
+    Move& operator[](int i) { return moves[i]; }
+    const Move& operator[](int i) const { return moves[i]; }
+    Move* begin() { return moves; }
+    Move* end() { return moves + count; }
+    const Move* begin() const { return moves; }
+    const Move* end() const { return moves + count; }
+};
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef MOVEGEN_H
+#define MOVEGEN_H
+
+#include "board.h"
+#include "move.h"
+
+// CAPTURES yields captures, en passant and queen promotions; QUIETS yields
+// everything else. Together they make up LEGAL. All generated moves are
+// legal: checkers and pinned pieces are resolved once per call.
+enum GenType {
+    CAPTURES,
+    QUIETS,
+    LEGAL
+};
+
+namespace MoveGen {
+    void generate(GenType type, const Board& board, MoveList& moves);
+    bool hasLegalMove(const Board& board);
+    Bitboard pinnedPieces(const Board& board, Color color);
+}
+
+#endif
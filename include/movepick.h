@@ -0,0 +1,85 @@
+#ifndef MOVEPICK_H
+#define MOVEPICK_H
+
+#include "board.h"
+#include "move.h"
+#include <cstdint>
+
+// History tables are indexed by Piece::getCode(), so code 0 (no piece) is
+// never written and serves as an all-zero sentinel
+constexpr int PIECE_CODES = 16;
+constexpr int HISTORY_MAX = 16384;
+
+using ButterflyHistory = int16_t[2][64][64];
+using PieceToHistory = int16_t[PIECE_CODES][64];
+using ContinuationHistory = PieceToHistory[PIECE_CODES][64];
+
+// Move ordering statistics gathered by one search thread. Large enough that
+// it has to live on the heap.
+struct SearchHistory {
+    ButterflyHistory butterfly;
+    ContinuationHistory continuation;
+    Move counterMoves[PIECE_CODES][64];
+
+    void clear();
+};
+
+// Gravity update: the entry moves towards the bonus and never leaves
+// [-HISTORY_MAX, HISTORY_MAX]
+inline void updateHistory(int16_t& entry, int bonus) {
+    int clamped = bonus < -HISTORY_MAX ? -HISTORY_MAX : bonus > HISTORY_MAX ? HISTORY_MAX : bonus;
+    entry += clamped - entry * (clamped < 0 ? -clamped : clamped) / HISTORY_MAX;
+}
+
+// Hands out the moves of a position one at a time, best guess first: the
+// hash move, captures by MVV-LVA that do not lose material, killers, the
+// counter-move, quiets by history and finally the losing captures. Each
+// stage is generated only when the search asks past the previous one, so a
+// cutoff on the hash move costs no generation at all.
+class MovePicker {
+private:
+    enum Stage {
+        TT_MOVE,
+        CAPTURE_INIT,
+        GOOD_CAPTURES,
+        KILLER_1,
+        KILLER_2,
+        COUNTER_MOVE,
+        QUIET_INIT,
+        QUIETS_STAGE,
+        BAD_CAPTURES,
+        DONE
+    };
+
+    const Board& board;
+    const SearchHistory& history;
+    const PieceToHistory* continuation[2];
+    Move ttMove;
+    Move refutations[3];
+    MoveList moves;
+    int current;
+    int badCaptures;
+    int stage;
+    bool capturesOnly;
+    bool quietsSkipped;
+
+    bool isRefutation(Move move) const;
+    bool isUsableRefutation(Move move) const;
+    void scoreCaptures();
+    void scoreQuiets();
+    Move pickBest();
+
+public:
+    // continuation holds the tables of the moves one and two plies back
+    MovePicker(const Board& board, Move ttMove, const Move killers[2], Move counterMove,
+               const SearchHistory& history, const PieceToHistory* const continuation[2]);
+    // Quiescence: the hash move and captures in MVV-LVA order, losing ones
+    // included; when in check every evasion is generated instead
+    MovePicker(const Board& board, Move ttMove,
+               const SearchHistory& history, const PieceToHistory* const continuation[2]);
+    Move next();
+    // Late move pruning: no further quiet moves are wanted at this node
+    void skipQuiets() { quietsSkipped = true; }
+};
+
+#endif
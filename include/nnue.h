@@ -21,11 +21,34 @@ private:
     static constexpr int HIDDEN_SIZE = 256;
     static constexpr int OUTPUT_SIZE = 1;
     
-    struct alignas(32) AccumulatorEntry {
+    // Pieces a move adds or removes: the moved piece, a capture, and the
+    // rook when castling. from or to is NO_SQUARE for a removal or an
+    // addition, as for the captured piece or a promotion.
+    struct DirtyPieces {
+        int count;
+        Piece piece[3];
+        uint8_t from[3];
+        uint8_t to[3];
+    };
+
+    // One ply of the accumulator stack. values hold the weighted feature
+    // sums before activation, per perspective (0 black, 1 white), and are
+    // only brought up to date when a position is evaluated.
+    struct alignas(32) Accumulator {
+        std::array<int16_t, HIDDEN_SIZE> values[2];
+        DirtyPieces dirty;
+        bool computed[2];
+        // The perspective's king moved into this ply, so its bucket changed
+        bool kingMoved[2];
+    };
+    
+    // Refresh cache ("Finny table"), one entry per perspective and king
+    // square: the accumulator of the last position refreshed with that
+    // bucket and the pieces it was built from. A refresh then only adds
+    // and removes the pieces that differ, which is little in a king walk.
+    struct alignas(32) RefreshEntry {
         std::array<int16_t, HIDDEN_SIZE> values;
-        int kingSquare;
-        bool computed;
-        std::array<uint8_t, 27> padding;
+        Bitboard pieces[2][KING];           // [color][type], kings excluded
     };
     
     struct alignas(32) LayerWeights {
@@ -34,13 +57,22 @@ private:
         std::array<uint8_t, 30> padding;
     };
     
-    std::vector<LayerWeights> featureWeights;
-    std::array<int16_t, HIDDEN_SIZE> outputWeights;
-    int16_t outputBias;
+    // Read-only once loaded, so copies of an NNUE (one per search thread)
+    // share them and only duplicate the accumulators
+    struct Weights {
+        std::vector<LayerWeights> featureWeights;
+        alignas(32) std::array<int16_t, HIDDEN_SIZE> outputWeights;
+        int16_t outputBias;
+    };
+    
+    std::shared_ptr<const Weights> weights;
     
-    std::array<AccumulatorEntry, 2> accumulator;
-    std::array<AccumulatorEntry, 32> accumulatorStack;
-    int accumulatorStackSize;
+    // Entry 0 is the root; one more per move made on top of it
+    static constexpr int STACK_SIZE = MAX_PLY + 1;
+    std::unique_ptr<Accumulator[]> stack;
+    int stackTop;
+    // [perspective * 64 + king square]; per copy, never shared
+    std::unique_ptr<RefreshEntry[]> refreshTable;
     
     std::unique_ptr<uint8_t[]> simdBuffer;
     
@@ -54,18 +86,24 @@ public:
     NNUE& operator=(NNUE&& other) noexcept;
     
     void loadWeights(const std::string& filename);
+    bool isLoaded() const { return weights && !weights->featureWeights.empty(); }
+    // Gives this copy weights of its own, allocated by the calling thread;
+    // used to keep one copy per NUMA node in that node's memory
+    void replicateWeights();
+    // Starts a new stack with board at its root
     void refreshAccumulator(const Board& board);
-    void updateAccumulator(const Board& board, const Move& move);
     int evaluate(const Board& board, bool perspective);
     
-    void pushAccumulator();
-    void popAccumulator();
+    // Called with the board before move is made, and after it is unmade
+    void pushAccumulator(const Board& board, Move move);
+    void popAccumulator() { stackTop--; }
     
 private:
-    int16_t clamp(int32_t x);
     int getFeatureIndex(const Piece& piece, int square, int kingSquare, bool perspective) const;
     void initializeAccumulator(const Board& board, bool perspective);
-    void applyBatchActivation(int16_t* values, size_t size);
+    void clearRefreshTable();
+    void updateAccumulator(const Board& board, bool perspective);
+    void applyDirtyPieces(const Accumulator& previous, Accumulator& next, int kingSquare, bool perspective);
     simd::vec_type* getSIMDBuffer();
 };
 
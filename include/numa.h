@@ -0,0 +1,33 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <string>
+#include <vector>
+
+// NUMA topology and thread binding. On systems without NUMA support, or
+// where it cannot be read, everything is one node and binding is a no-op.
+namespace Numa {
+
+enum Policy {
+    POLICY_AUTO,    // Bind once the threads outgrow the largest node
+    POLICY_NONE,    // Leave placement to the OS
+    POLICY_BIND     // Always bind, even within one node
+};
+
+// Parses "auto", "none" or "bind"; anything else is auto
+Policy parsePolicy(const std::string& name);
+
+int nodeCount();
+// Logical processors of the node
+int cpuCount(int node);
+
+// The node each of threadCount search threads should run on, or an empty
+// vector when the policy does not bind
+std::vector<int> assignNodes(Policy policy, int threadCount);
+
+// Restricts the calling thread to the processors of node
+void bindThisThread(int node);
+
+}
+
+#endif
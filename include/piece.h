@@ -1,6 +1,8 @@
 #ifndef PIECE_H
 #define PIECE_H
 
+#include <cstdint>
+
 enum PieceType {
     EMPTY,
     PAWN,
@@ -16,17 +18,19 @@ enum Color {
     BLACK
 };
 
+// Packed into a single byte (type in the low three bits, color above) so
+// that Board can keep a compact 64-byte mailbox next to its bitboards.
 class Piece {
 private:
-    PieceType type;
-    Color color;
+    uint8_t code;
     
 public:
-    Piece();
-    Piece(PieceType t, Color c);
+    Piece() : code(EMPTY) {}
+    Piece(PieceType t, Color c) : code(static_cast<uint8_t>(t | (c << 3))) {}
     
-    PieceType getType() const;
-    Color getColor() const;
+    PieceType getType() const { return static_cast<PieceType>(code & 7); }
+    Color getColor() const { return static_cast<Color>(code >> 3); }
+    int getCode() const { return code; }
     int getValue() const;
     bool isValidMove(int fromX, int fromY, int toX, int toY, bool isCapture) const;
 };
@@ -0,0 +1,44 @@
+#ifndef TIMEMAN_H
+#define TIMEMAN_H
+
+#include "piece.h"
+#include <chrono>
+#include <cstdint>
+
+// Limits from a "go" command; -1 (or 0 for nodes) means not given
+struct SearchLimits {
+    int depth = -1;
+    int movetime = -1;
+    int wtime = -1;
+    int btime = -1;
+    int winc = 0;
+    int binc = 0;
+    int movestogo = 0;
+    uint64_t nodes = 0;
+    bool infinite = false;
+    bool ponder = false;
+
+    bool usesClock() const { return wtime >= 0 || btime >= 0 || movetime >= 0; }
+};
+
+// Turns the clock into two budgets: the optimum (soft) time after which no
+// new iteration should start, scaled each iteration by how settled the
+// search looks, and the maximum (hard) time at which the search is stopped
+// outright.
+class TimeManager {
+private:
+    std::chrono::steady_clock::time_point start;
+    int64_t optimumTime;
+    int64_t maximumTime;
+    bool enabled;
+
+public:
+    TimeManager() : optimumTime(0), maximumTime(0), enabled(false) {}
+    void init(const SearchLimits& limits, Color us, int moveOverhead);
+    int64_t elapsed() const;
+    int64_t getOptimum() const { return optimumTime; }
+    int64_t getMaximum() const { return maximumTime; }
+    bool isEnabled() const { return enabled; }
+};
+
+#endif
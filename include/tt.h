@@ -0,0 +1,111 @@
+#ifndef TT_H
+#define TT_H
+
+#include "move.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum Bound : uint8_t {
+    BOUND_NONE,
+    BOUND_UPPER,
+    BOUND_LOWER,
+    BOUND_EXACT = BOUND_UPPER | BOUND_LOWER
+};
+
+// Ten bytes: the lower 16 key bits, the move, search score and static eval,
+// depth (stored with an offset so that zero marks an empty slot) and the
+// generation sharing a byte with the bound. The cluster index comes from the
+// upper key bits, so the lower ones are the only independent check.
+struct TTEntry {
+    uint16_t key16;
+    uint16_t move;
+    int16_t score;
+    int16_t eval;
+    uint8_t depth8;
+    uint8_t genBound8;
+
+    Move getMove() const { return Move::fromRaw(move); }
+    int getScore() const { return score; }
+    int getEval() const { return eval; }
+    int getDepth() const { return depth8 - DEPTH_OFFSET; }
+    Bound getBound() const { return static_cast<Bound>(genBound8 & 3); }
+    void save(uint64_t key, int score, int eval, Bound bound, int depth, Move move, uint8_t generation);
+
+    static constexpr int DEPTH_OFFSET = 1;
+};
+
+enum PageKind {
+    PAGES_SMALL,
+    PAGES_TRANSPARENT,      // Transparent huge pages were requested
+    PAGES_HUGETLB           // Explicit huge pages (Linux) or large pages (Windows)
+};
+
+// Shared by all search threads without locks. A slot is only trusted when
+// its key fragment matches, and a move read from it is checked for
+// legality before use, so a torn write costs at most a wasted probe.
+class TranspositionTable {
+private:
+    static constexpr int CLUSTER_SIZE = 3;
+
+    // Three entries and padding fill 32 bytes, so a cluster never
+    // straddles a cache line
+    struct alignas(32) Cluster {
+        TTEntry entry[CLUSTER_SIZE];
+        char padding[2];
+    };
+
+    Cluster* table;
+    size_t clusterCount;
+    size_t sizeMB;
+    size_t allocatedBytes;
+    PageKind pageKind;
+    int threadCount;
+    std::vector<int> threadNodes;
+    uint8_t generation8;
+
+    Cluster* clusterFor(uint64_t key) const;
+    void release();
+
+public:
+    static constexpr int MIN_SIZE_MB = 1;
+    static constexpr int MAX_SIZE_MB = 32768;
+
+    TranspositionTable() : table(nullptr), clusterCount(0), sizeMB(0), allocatedBytes(0),
+        pageKind(PAGES_SMALL), threadCount(1), generation8(0) {}
+    ~TranspositionTable() { release(); }
+    TranspositionTable(const TranspositionTable&) = delete;
+    TranspositionTable& operator=(const TranspositionTable&) = delete;
+
+    // Large tables are put on huge pages where the system has them: an
+    // explicit hugetlb mapping first, then transparent huge pages, then
+    // ordinary pages
+    void resize(size_t megabytes);
+    // Clearing, and with it the first touch of every page, is split over
+    // the search threads
+    void clear();
+    void setThreadCount(int count) { threadCount = count < 1 ? 1 : count; }
+    // NUMA node of each search thread, empty when they are not bound; the
+    // clearing threads are bound the same way
+    void setThreadNodes(const std::vector<int>& nodes) { threadNodes = nodes; }
+    // The page size actually backing the table, for an info string
+    std::string pageDescription() const;
+    void newSearch() { generation8 += 8; }
+    uint8_t getGeneration() const { return generation8; }
+
+    // Returns the matching entry with found set, or the slot to overwrite
+    TTEntry* probe(uint64_t key, bool& found) const;
+    void prefetch(uint64_t key) const;
+    // Permille of sampled slots written during the current search
+    int hashfull() const;
+
+    // The table is written as a raw image behind a header. load() resizes
+    // to the saved size and reads the clusters back in place, so nothing
+    // is rehashed; it returns the new size in MB, or 0 if the file is
+    // missing, short, or from a build with another entry layout or keys.
+    bool save(const std::string& filename) const;
+    size_t load(const std::string& filename);
+};
+
+#endif
@@ -2,15 +2,22 @@
 #define UCI_H
 
 #include "engine.h"
+#include "book.h"
 #include "board.h"
 #include <string>
+#include <thread>
 
 class UCI {
 private:
     bool running;
     bool debugMode;
     Engine engine;
+    Book book;
+    std::string hashFile;
     Board board;
+    std::thread searchThread;
+    
+    void waitForSearch();
     
 public:
     UCI();
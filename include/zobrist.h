@@ -0,0 +1,67 @@
+#ifndef ZOBRIST_H
+#define ZOBRIST_H
+
+#include "piece.h"
+#include <cstdint>
+
+namespace Zobrist {
+
+struct Keys {
+    uint64_t psq[2][KING + 1][64];
+    uint64_t castling[16];
+    uint64_t enPassant[8];
+    uint64_t side;
+    uint64_t noPawns;
+};
+
+namespace detail {
+
+constexpr uint64_t splitMix(uint64_t& state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Generated by the compiler from a fixed seed, so keys are identical across
+// builds and nothing has to run at startup.
+constexpr Keys makeKeys() {
+    Keys keys{};
+    uint64_t state = 0x44535A6F62726973ULL;
+
+    for(int color = 0; color < 2; color++) {
+        for(int type = PAWN; type <= KING; type++) {
+            for(int square = 0; square < 64; square++) {
+                keys.psq[color][type][square] = splitMix(state);
+            }
+        }
+    }
+
+    // Castling keys are composed so that any combination is the XOR of the
+    // keys of its individual rights.
+    uint64_t rights[4] = {splitMix(state), splitMix(state), splitMix(state), splitMix(state)};
+    for(int cr = 0; cr < 16; cr++) {
+        for(int bit = 0; bit < 4; bit++) {
+            if(cr & (1 << bit)) keys.castling[cr] ^= rights[bit];
+        }
+    }
+
+    for(int file = 0; file < 8; file++) {
+        keys.enPassant[file] = splitMix(state);
+    }
+    keys.side = splitMix(state);
+    keys.noPawns = splitMix(state);
+    return keys;
+}
+
+} // namespace detail
+
+inline constexpr Keys keys = detail::makeKeys();
+
+inline uint64_t psq(Piece piece, int square) {
+    return keys.psq[piece.getColor()][piece.getType()][square];
+}
+
+} // namespace Zobrist
+
+#endif
@@ -1,7 +1,9 @@
 #include "uci.h"
+#include "bitboard.h"
 #include <iostream>
 
 int main() {
+    Bitboards::init();
     UCI uci;
     uci.start();
     return 0;
@@ -0,0 +1,46 @@
+#include "../include/alloc_counter.h"
+
+#if defined(DEEPSQUARE_COUNT_ALLOCS)
+
+#include <cstdlib>
+#include <new>
+
+namespace {
+    thread_local uint64_t allocations = 0;
+}
+
+namespace AllocCounter {
+    uint64_t count() {
+        return allocations;
+    }
+}
+
+void* operator new(std::size_t size) {
+    allocations++;
+    if(void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+#endif
@@ -0,0 +1,208 @@
+#include "../include/bitboard.h"
+#include <chrono>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+    #else
+        #include <cpuid.h>
+    #endif
+#endif
+
+namespace Bitboards {
+
+Magic rookMagics[64];
+Magic bishopMagics[64];
+bool usePext = false;
+
+namespace {
+
+Bitboard rookTable[0x19000];
+Bitboard bishopTable[0x1480];
+long long initTime = 0;
+
+#if defined(DEEPSQUARE_SEARCH_MAGICS)
+
+// Small xorshift generator; a fixed seed per rank keeps the search
+// deterministic, which is how the table below was produced.
+class Prng {
+    uint64_t s;
+public:
+    explicit Prng(uint64_t seed) : s(seed) {}
+    uint64_t next() {
+        s ^= s >> 12;
+        s ^= s << 25;
+        s ^= s >> 27;
+        return s * 2685821657736338717ULL;
+    }
+    uint64_t sparse() { return next() & next() & next(); }
+};
+
+Bitboard findMagic(PieceType type, int square, Bitboard mask, unsigned shift) {
+    static const uint64_t seeds[8] = {728, 10316, 55013, 32803, 12281, 15100, 16645, 255};
+    Bitboard occupancy[4096], reference[4096];
+    int epoch[4096] = {}, current = 0, size = 0;
+    Bitboard used[4096];
+
+    Bitboard occ = 0;
+    do {
+        occupancy[size] = occ;
+        reference[size] = detail::slidingAttacks(type, square, occ);
+        size++;
+        occ = (occ - mask) & mask;
+    } while(occ);
+
+    Prng rng(seeds[rankOf(square)]);
+    for(;;) {
+        Bitboard magic;
+        do {
+            magic = rng.sparse();
+        } while(popCount((magic * mask) >> 56) < 6);
+
+        current++;
+        int i = 0;
+        for(; i < size; i++) {
+            unsigned idx = static_cast<unsigned>((occupancy[i] * magic) >> shift);
+            if(epoch[idx] < current) {
+                epoch[idx] = current;
+                used[idx] = reference[i];
+            } else if(used[idx] != reference[i]) {
+                break;
+            }
+        }
+        if(i == size) return magic;
+    }
+}
+
+#else
+
+// Generated offline with -DDEEPSQUARE_SEARCH_MAGICS so that startup only has
+// to fill the attack tables.
+const Bitboard rookMagicNumbers[64] = {
+    0x0A80004000801220ULL, 0x8040004010002008ULL, 0x2080200010008008ULL, 0x1100100008210004ULL,
+    0xC200209084020008ULL, 0x2100010004000208ULL, 0x0400081000822421ULL, 0x0200010422048844ULL,
+    0x0800800080400024ULL, 0x0001402000401000ULL, 0x3000801000802001ULL, 0x4400800800100083ULL,
+    0x0904802402480080ULL, 0x4040800400020080ULL, 0x0018808042000100ULL, 0x4040800080004100ULL,
+    0x0040048001458024ULL, 0x00A0004000205000ULL, 0x3100808010002000ULL, 0x4825010010000820ULL,
+    0x5004808008000401ULL, 0x2024818004000A00ULL, 0x0005808002000100ULL, 0x2100060004806104ULL,
+    0x0080400880008421ULL, 0x4062220600410280ULL, 0x010A004A00108022ULL, 0x0000100080080080ULL,
+    0x0021000500080010ULL, 0x0044000202001008ULL, 0x0000100400080102ULL, 0xC020128200040545ULL,
+    0x0080002000400040ULL, 0x0000804000802004ULL, 0x0000120022004080ULL, 0x010A386103001001ULL,
+    0x9010080080800400ULL, 0x8440020080800400ULL, 0x0004228824001001ULL, 0x000000490A000084ULL,
+    0x0080002000504000ULL, 0x200020005000C000ULL, 0x0012088020420010ULL, 0x0010010080080800ULL,
+    0x0085001008010004ULL, 0x0002000204008080ULL, 0x0040413002040008ULL, 0x0000304081020004ULL,
+    0x0080204000800080ULL, 0x3008804000290100ULL, 0x1010100080200080ULL, 0x2008100208028080ULL,
+    0x5000850800910100ULL, 0x8402019004680200ULL, 0x0120911028020400ULL, 0x0000008044010200ULL,
+    0x0020850200244012ULL, 0x0020850200244012ULL, 0x0000102001040841ULL, 0x140900040A100021ULL,
+    0x000200282410A102ULL, 0x000200282410A102ULL, 0x000200282410A102ULL, 0x4048240043802106ULL
+};
+
+const Bitboard bishopMagicNumbers[64] = {
+    0x40106000A1160020ULL, 0x0020010250810120ULL, 0x2010010220280081ULL, 0x002806004050C040ULL,
+    0x0002021018000000ULL, 0x2001112010000400ULL, 0x0881010120218080ULL, 0x1030820110010500ULL,
+    0x0000120222042400ULL, 0x2000020404040044ULL, 0x8000480094208000ULL, 0x0003422A02000001ULL,
+    0x000A220210100040ULL, 0x8004820202226000ULL, 0x0018234854100800ULL, 0x0100004042101040ULL,
+    0x0004001004082820ULL, 0x0010000810010048ULL, 0x1014004208081300ULL, 0x2080818802044202ULL,
+    0x0040880C00A00100ULL, 0x0080400200522010ULL, 0x0001000188180B04ULL, 0x0080249202020204ULL,
+    0x1004400004100410ULL, 0x00013100A0022206ULL, 0x2148500001040080ULL, 0x4241080011004300ULL,
+    0x4020848004002000ULL, 0x10101380D1004100ULL, 0x0008004422020284ULL, 0x01010A1041008080ULL,
+    0x0808080400082121ULL, 0x0808080400082121ULL, 0x0091128200100C00ULL, 0x0202200802010104ULL,
+    0x8C0A020200440085ULL, 0x01A0008080B10040ULL, 0x0889520080122800ULL, 0x100902022202010AULL,
+    0x04081A0816002000ULL, 0x0000681208005000ULL, 0x8170840041008802ULL, 0x0A00004200810805ULL,
+    0x0830404408210100ULL, 0x2602208106006102ULL, 0x1048300680802628ULL, 0x2602208106006102ULL,
+    0x0602010120110040ULL, 0x0941010801043000ULL, 0x000040440A210428ULL, 0x0008240020880021ULL,
+    0x0400002012048200ULL, 0x00AC102001210220ULL, 0x0220021002009900ULL, 0x84440C080A013080ULL,
+    0x0001008044200440ULL, 0x0004C04410841000ULL, 0x2000500104011130ULL, 0x1A0C010011C20229ULL,
+    0x0044800112202200ULL, 0x0434804908100424ULL, 0x0300404822C08200ULL, 0x48081010008A2A80ULL
+};
+
+#endif
+
+bool cpuHasFastPext() {
+#if defined(HAS_PEXT) && (defined(__x86_64__) || defined(_M_X64))
+    unsigned int regs[4] = {0, 0, 0, 0};
+    char vendor[13] = {0};
+    #if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        for(int i = 0; i < 4; i++) regs[i] = static_cast<unsigned int>(info[i]);
+    #else
+        __cpuid(0, regs[0], regs[1], regs[2], regs[3]);
+    #endif
+    reinterpret_cast<unsigned int*>(vendor)[0] = regs[1];
+    reinterpret_cast<unsigned int*>(vendor)[1] = regs[3];
+    reinterpret_cast<unsigned int*>(vendor)[2] = regs[2];
+
+    #if defined(_MSC_VER)
+        __cpuidex(info, 7, 0);
+        bool bmi2 = (info[1] & (1 << 8)) != 0;
+        __cpuid(info, 1);
+        unsigned int eax = static_cast<unsigned int>(info[0]);
+    #else
+        __cpuid_count(7, 0, regs[0], regs[1], regs[2], regs[3]);
+        bool bmi2 = (regs[1] & (1u << 8)) != 0;
+        __cpuid(1, regs[0], regs[1], regs[2], regs[3]);
+        unsigned int eax = regs[0];
+    #endif
+    if(!bmi2) return false;
+
+    // Zen 1 and Zen 2 (family 17h) implement PEXT in microcode.
+    unsigned int family = ((eax >> 8) & 0xF) + ((eax >> 20) & 0xFF);
+    bool amd = std::strcmp(vendor, "AuthenticAMD") == 0;
+    return !(amd && family < 0x19);
+#else
+    return false;
+#endif
+}
+
+void initMagics(PieceType type, Magic magics[64], Bitboard* table) {
+    Bitboard* next = table;
+
+    for(int square = 0; square < 64; square++) {
+        // Edge squares never change whether a ray is blocked
+        Bitboard edges = ((RANK_1_BB | RANK_8_BB) & ~(RANK_1_BB << (8 * rankOf(square))))
+                       | ((FILE_A_BB | FILE_H_BB) & ~(FILE_A_BB << fileOf(square)));
+
+        Magic& m = magics[square];
+        m.mask = detail::slidingAttacks(type, square, 0) & ~edges;
+        m.shift = 64 - popCount(m.mask);
+        m.attacks = next;
+#if defined(DEEPSQUARE_SEARCH_MAGICS)
+        m.magic = findMagic(type, square, m.mask, m.shift);
+#else
+        m.magic = (type == ROOK ? rookMagicNumbers : bishopMagicNumbers)[square];
+#endif
+
+        Bitboard occ = 0;
+        do {
+            next[m.index(occ)] = detail::slidingAttacks(type, square, occ);
+            occ = (occ - m.mask) & m.mask;
+        } while(occ);
+
+        next += 1ULL << popCount(m.mask);
+    }
+}
+
+} // namespace
+
+void init() {
+    auto start = std::chrono::steady_clock::now();
+
+    usePext = cpuHasFastPext();
+    initMagics(ROOK, rookMagics, rookTable);
+    initMagics(BISHOP, bishopMagics, bishopTable);
+
+    initTime = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+long long initMicros() {
+    return initTime;
+}
+
+const char* sliderIndexing() {
+    return usePext ? "pext" : "magic";
+}
+
+} // namespace Bitboards
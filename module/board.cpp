@@ -1,49 +1,413 @@
 #include "../include/board.h"
+#include "../include/movegen.h"
+#include "../include/zobrist.h"
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+
+namespace {
+
+// Rights that survive a move touching the square
+constexpr uint8_t castlingMask(int square) {
+    switch(square) {
+        case 0: return ALL_CASTLING & ~WHITE_OOO;
+        case 4: return ALL_CASTLING & ~(WHITE_OO | WHITE_OOO);
+        case 7: return ALL_CASTLING & ~WHITE_OO;
+        case 56: return ALL_CASTLING & ~BLACK_OOO;
+        case 60: return ALL_CASTLING & ~(BLACK_OO | BLACK_OOO);
+        case 63: return ALL_CASTLING & ~BLACK_OO;
+        default: return ALL_CASTLING;
+    }
+}
+
+inline Color opposite(Color c) {
+    return c == WHITE ? BLACK : WHITE;
+}
+
+// Exchange values; the king is never given up, so it counts as nothing
+constexpr int seeValues[KING + 1] = {0, 100, 320, 330, 500, 900, 0};
+
+inline bool isCastling(Piece piece, int from, int to) {
+    return piece.getType() == KING && std::abs(fileOf(to) - fileOf(from)) == 2;
+}
+
+} // namespace
 
 Board::Board() : whiteToMove(true) {
     initialize();
 }
 
-void Board::initialize() {
-    
-    board[0][0] = Piece(ROOK, WHITE);
-    board[0][1] = Piece(KNIGHT, WHITE);
-    board[0][2] = Piece(BISHOP, WHITE);
-    board[0][3] = Piece(QUEEN, WHITE);
-    board[0][4] = Piece(KING, WHITE);
-    board[0][5] = Piece(BISHOP, WHITE);
-    board[0][6] = Piece(KNIGHT, WHITE);
-    board[0][7] = Piece(ROOK, WHITE);
-    
-    for(int x = 0; x < 8; x++) {
-        board[1][x] = Piece(PAWN, WHITE);
-    }
-    
-    
-    board[7][0] = Piece(ROOK, BLACK);
-    board[7][1] = Piece(KNIGHT, BLACK);
-    board[7][2] = Piece(BISHOP, BLACK);
-    board[7][3] = Piece(QUEEN, BLACK);
-    board[7][4] = Piece(KING, BLACK);
-    board[7][5] = Piece(BISHOP, BLACK);
-    board[7][6] = Piece(KNIGHT, BLACK);
-    board[7][7] = Piece(ROOK, BLACK);
-    
-    for(int x = 0; x < 8; x++) {
-        board[6][x] = Piece(PAWN, BLACK);
+void Board::clear() {
+    for(Bitboard& b : byType) b = 0;
+    byColor[WHITE] = byColor[BLACK] = 0;
+    for(Piece& p : mailbox) p = Piece();
+    kingSquare[WHITE] = kingSquare[BLACK] = NO_SQUARE;
+    stateIndex = 0;
+    states[0] = StateInfo{0, 0, 0, 0, Piece(), NO_CASTLING, NO_SQUARE, 0, 0};
+    gamePly = 0;
+}
+
+void Board::computeKeys() {
+    StateInfo& st = states[stateIndex];
+    st.key = st.pawnKey = st.materialKey = 0;
+
+    Bitboard occupied = getOccupied();
+    while(occupied) {
+        int square = popLsb(occupied);
+        Piece piece = mailbox[square];
+        st.key ^= Zobrist::psq(piece, square);
+        if(piece.getType() == PAWN) {
+            st.pawnKey ^= Zobrist::psq(piece, square);
+        }
+    }
+
+    for(int color = WHITE; color <= BLACK; color++) {
+        for(int type = PAWN; type <= KING; type++) {
+            int count = popCount(byType[type] & byColor[color]);
+            for(int i = 0; i < count; i++) {
+                st.materialKey ^= Zobrist::keys.psq[color][type][i];
+            }
+        }
+    }
+
+    if(!byType[PAWN]) {
+        st.pawnKey = Zobrist::keys.noPawns;
     }
-    
-   
-    for(int y = 2; y < 6; y++) {
-        for(int x = 0; x < 8; x++) {
-            board[y][x] = Piece();
+    st.key ^= Zobrist::keys.castling[st.castlingRights];
+    if(st.epSquare != NO_SQUARE) {
+        st.key ^= Zobrist::keys.enPassant[fileOf(st.epSquare)];
+    }
+    if(!whiteToMove) {
+        st.key ^= Zobrist::keys.side;
+    }
+
+    gamePly = 0;
+    keyHistory[0] = KeyHistoryEntry{st.key, 0};
+}
+
+void Board::computeCheckers() {
+    Color us = getSideToMove();
+    states[stateIndex].checkers = attackersTo(kingSquare[us], getOccupied()) & byColor[opposite(us)];
+}
+
+void Board::pushKeyHistory() {
+    const StateInfo& st = states[stateIndex];
+    KeyHistoryEntry& entry = keyHistory[++gamePly % KEY_HISTORY_SIZE];
+    entry.key = st.key;
+    entry.repetition = 0;
+
+    // A position can only repeat since the last irreversible move, and a
+    // line through a null move proves nothing about repetitions
+    int end = std::min<int>(std::min(st.halfmoveClock, st.pliesFromNull), gamePly);
+    for(int i = 4; i <= end; i += 2) {
+        const KeyHistoryEntry& earlier = keyHistory[(gamePly - i) % KEY_HISTORY_SIZE];
+        if(earlier.key == st.key) {
+            entry.repetition = earlier.repetition ? -i : i;
+            break;
         }
     }
 }
 
+void Board::putPiece(Piece piece, int square) {
+    Bitboard b = squareBB(square);
+    byType[piece.getType()] |= b;
+    byColor[piece.getColor()] |= b;
+    mailbox[square] = piece;
+    if(piece.getType() == KING) {
+        kingSquare[piece.getColor()] = static_cast<uint8_t>(square);
+    }
+}
+
+void Board::removePiece(int square) {
+    Piece piece = mailbox[square];
+    Bitboard b = squareBB(square);
+    byType[piece.getType()] &= ~b;
+    byColor[piece.getColor()] &= ~b;
+    mailbox[square] = Piece();
+}
+
+void Board::movePiece(int from, int to) {
+    Piece piece = mailbox[from];
+    Bitboard fromTo = squareBB(from) | squareBB(to);
+    byType[piece.getType()] ^= fromTo;
+    byColor[piece.getColor()] ^= fromTo;
+    mailbox[to] = piece;
+    mailbox[from] = Piece();
+    if(piece.getType() == KING) {
+        kingSquare[piece.getColor()] = static_cast<uint8_t>(to);
+    }
+}
+
+void Board::initialize() {
+    static const PieceType backRank[8] = {ROOK, KNIGHT, BISHOP, QUEEN, KING, BISHOP, KNIGHT, ROOK};
+
+    clear();
+    for(int x = 0; x < 8; x++) {
+        putPiece(Piece(backRank[x], WHITE), makeSquare(x, 0));
+        putPiece(Piece(PAWN, WHITE), makeSquare(x, 1));
+        putPiece(Piece(PAWN, BLACK), makeSquare(x, 6));
+        putPiece(Piece(backRank[x], BLACK), makeSquare(x, 7));
+    }
+    whiteToMove = true;
+    states[0].castlingRights = ALL_CASTLING;
+    computeKeys();
+    computeCheckers();
+}
+
 Piece Board::getPiece(int x, int y) const {
     if(x < 0 || x >= 8 || y < 0 || y >= 8) return Piece();
-    return board[y][x];
+    return mailbox[makeSquare(x, y)];
+}
+
+Bitboard Board::attackersTo(int square, Bitboard occupied) const {
+    Bitboard bishops = byType[BISHOP] | byType[QUEEN];
+    Bitboard rooks = byType[ROOK] | byType[QUEEN];
+
+    return (Bitboards::pawnAttacks(BLACK, square) & byType[PAWN] & byColor[WHITE])
+         | (Bitboards::pawnAttacks(WHITE, square) & byType[PAWN] & byColor[BLACK])
+         | (Bitboards::knightAttacks(square) & byType[KNIGHT])
+         | (Bitboards::kingAttacks(square) & byType[KING])
+         | (Bitboards::bishopAttacks(square, occupied) & bishops)
+         | (Bitboards::rookAttacks(square, occupied) & rooks);
+}
+
+Bitboard Board::pieceTargets(int square) const {
+    Piece piece = mailbox[square];
+    Color us = piece.getColor();
+    Bitboard occupied = getOccupied();
+    const StateInfo& st = states[stateIndex];
+
+    if(piece.getType() == KING) {
+        Bitboard targets = Bitboards::kingAttacks(square) & ~byColor[us];
+        int home = us == WHITE ? 4 : 60;
+        int rights = st.castlingRights & (us == WHITE ? (WHITE_OO | WHITE_OOO) : (BLACK_OO | BLACK_OOO));
+        if(square == home && rights) {
+            if((rights & (WHITE_OO | BLACK_OO)) && !(occupied & Bitboards::between(home, home + 3))) {
+                targets |= squareBB(home + 2);
+            }
+            if((rights & (WHITE_OOO | BLACK_OOO)) && !(occupied & Bitboards::between(home, home - 4))) {
+                targets |= squareBB(home - 2);
+            }
+        }
+        return targets;
+    }
+
+    if(piece.getType() != PAWN) {
+        return Bitboards::attacks(piece.getType(), square, occupied) & ~byColor[us];
+    }
+
+    Bitboard enemies = byColor[opposite(us)];
+    if(st.epSquare != NO_SQUARE) {
+        enemies |= squareBB(st.epSquare);
+    }
+    Bitboard targets = Bitboards::pawnAttacks(us, square) & enemies;
+    int push = us == WHITE ? 8 : -8;
+    if(!(occupied & squareBB(square + push))) {
+        targets |= squareBB(square + push);
+        int startRank = us == WHITE ? 1 : 6;
+        if(rankOf(square) == startRank && !(occupied & squareBB(square + 2 * push))) {
+            targets |= squareBB(square + 2 * push);
+        }
+    }
+    return targets;
+}
+
+bool Board::isSquareAttacked(int square, Color attacker) const {
+    return (attackersTo(square, getOccupied()) & byColor[attacker]) != 0;
+}
+
+// Tests whether a move taken from pieceTargets() leaves our king safe,
+// without touching the board.
+bool Board::isLegal(Move move) const {
+    int from = move.getFrom();
+    int to = move.getTo();
+    Piece piece = mailbox[from];
+    Color us = piece.getColor();
+    Color them = opposite(us);
+    Bitboard occupied = getOccupied();
+
+    if(piece.getType() == KING) {
+        if(move.getFlag() == CASTLING) {
+            int step = to > from ? 1 : -1;
+            return !isSquareAttacked(from, them)
+                && !isSquareAttacked(from + step, them)
+                && !isSquareAttacked(to, them);
+        }
+        return !(attackersTo(to, occupied ^ squareBB(from)) & byColor[them]);
+    }
+
+    int ksq = kingSquare[us];
+    if(move.getFlag() == EN_PASSANT) {
+        int capSq = to + (us == WHITE ? -8 : 8);
+        Bitboard after = (occupied ^ squareBB(from) ^ squareBB(capSq)) | squareBB(to);
+        return !(attackersTo(ksq, after) & byColor[them] & ~squareBB(capSq));
+    }
+
+    Bitboard after = (occupied ^ squareBB(from)) | squareBB(to);
+    return !(attackersTo(ksq, after) & byColor[them] & ~squareBB(to));
+}
+
+// Checks a move that did not come from the generator (hash move, killer)
+// against the current position; isLegal() still has to pass afterwards.
+bool Board::isPseudoLegal(Move move) const {
+    int from = move.getFrom();
+    int to = move.getTo();
+    Piece piece = mailbox[from];
+
+    if(move.isNull() || piece.getType() == EMPTY || piece.getColor() != getSideToMove() ||
+       !(pieceTargets(from) & squareBB(to))) {
+        return false;
+    }
+
+    MoveFlag flag = NORMAL;
+    if(isCastling(piece, from, to)) {
+        flag = CASTLING;
+    } else if(piece.getType() == PAWN && to == states[stateIndex].epSquare) {
+        flag = EN_PASSANT;
+    } else if(piece.getType() == PAWN && (squareBB(to) & (RANK_1_BB | RANK_8_BB))) {
+        flag = PROMOTION;
+    }
+    return move.getFlag() == flag;
+}
+
+// Whether a legal move checks the opponent, directly or by uncovering a
+// slider, without making it
+bool Board::givesCheck(Move move) const {
+    int from = move.getFrom();
+    int to = move.getTo();
+    Color us = mailbox[from].getColor();
+    int ksq = kingSquare[opposite(us)];
+    Bitboard occupied = (getOccupied() ^ squareBB(from)) | squareBB(to);
+    Bitboard moved = squareBB(from);
+
+    if(move.getFlag() == CASTLING) {
+        bool kingSide = to > from;
+        int rookFrom = kingSide ? from + 3 : from - 4;
+        int rookTo = kingSide ? from + 1 : from - 1;
+        occupied = (occupied ^ squareBB(rookFrom)) | squareBB(rookTo);
+        if(Bitboards::rookAttacks(rookTo, occupied) & squareBB(ksq)) return true;
+        moved |= squareBB(rookFrom);
+    } else {
+        PieceType type = move.getFlag() == PROMOTION ? move.getPromotion() : mailbox[from].getType();
+        if(move.getFlag() == EN_PASSANT) {
+            occupied ^= squareBB(to + (us == WHITE ? -8 : 8));
+        }
+        Bitboard direct = type == PAWN ? Bitboards::pawnAttacks(us, to)
+                        : type == KING ? 0 : Bitboards::attacks(type, to, occupied);
+        if(direct & squareBB(ksq)) return true;
+    }
+
+    Bitboard sliders = (Bitboards::rookAttacks(ksq, occupied) & (byType[ROOK] | byType[QUEEN]))
+                     | (Bitboards::bishopAttacks(ksq, occupied) & (byType[BISHOP] | byType[QUEEN]));
+    return sliders & byColor[us] & ~moved;
+}
+
+// Least valuable piece of side among attackers, EMPTY if there is none
+PieceType Board::leastValuableAttacker(Bitboard attackers, Color side, int& square) const {
+    for(int type = PAWN; type <= KING; type++) {
+        Bitboard candidates = attackers & byType[type] & byColor[side];
+        if(candidates) {
+            square = lsb(candidates);
+            return static_cast<PieceType>(type);
+        }
+    }
+    return EMPTY;
+}
+
+// Material balance of the capture sequence on the destination square with
+// both sides always recapturing with their least valuable piece, x-rays
+// included. Castling, en passant and promotions count as even.
+int Board::see(Move move) const {
+    if(move.getFlag() != NORMAL) {
+        return 0;
+    }
+
+    int from = move.getFrom();
+    int to = move.getTo();
+    Bitboard bishops = byType[BISHOP] | byType[QUEEN];
+    Bitboard rooks = byType[ROOK] | byType[QUEEN];
+    Bitboard occupied = getOccupied() ^ squareBB(from);
+    Bitboard attackers = attackersTo(to, occupied) & occupied;
+    Color side = opposite(mailbox[from].getColor());
+    int onSquare = seeValues[mailbox[from].getType()];
+
+    int gain[32];
+    int depth = 0;
+    gain[0] = seeValues[mailbox[to].getType()];
+
+    while(depth < 31) {
+        int square;
+        PieceType attacker = leastValuableAttacker(attackers, side, square);
+        if(attacker == EMPTY) break;
+        // The king may only take when nothing can take it back
+        if(attacker == KING && (attackers & byColor[opposite(side)])) break;
+
+        depth++;
+        gain[depth] = onSquare - gain[depth - 1];
+        onSquare = seeValues[attacker];
+
+        occupied ^= squareBB(square);
+        attackers |= (Bitboards::bishopAttacks(to, occupied) & bishops)
+                   | (Bitboards::rookAttacks(to, occupied) & rooks);
+        attackers &= occupied;
+        side = opposite(side);
+    }
+
+    // Either side may stop capturing when continuing would lose material
+    while(depth > 0) {
+        gain[depth - 1] = std::min(gain[depth - 1], -gain[depth]);
+        depth--;
+    }
+    return gain[0];
+}
+
+// Whether see(move) >= threshold, stopping as soon as the outcome is known
+bool Board::seeGe(Move move, int threshold) const {
+    if(move.getFlag() != NORMAL) {
+        return 0 >= threshold;
+    }
+
+    int from = move.getFrom();
+    int to = move.getTo();
+
+    int swap = seeValues[mailbox[to].getType()] - threshold;
+    if(swap < 0) return false;
+
+    swap = seeValues[mailbox[from].getType()] - swap;
+    if(swap <= 0) return true;
+
+    Bitboard bishops = byType[BISHOP] | byType[QUEEN];
+    Bitboard rooks = byType[ROOK] | byType[QUEEN];
+    Bitboard occupied = getOccupied() ^ squareBB(from) ^ squareBB(to);
+    Bitboard attackers = attackersTo(to, occupied);
+    Color side = mailbox[from].getColor();
+    int result = 1;
+
+    while(true) {
+        side = opposite(side);
+        attackers &= occupied;
+        int square;
+        PieceType attacker = leastValuableAttacker(attackers, side, square);
+        if(attacker == EMPTY) break;
+
+        // A king capture stands only if the other side is out of attackers
+        if(attacker == KING) {
+            return (attackers & byColor[opposite(side)]) ? result : !result;
+        }
+
+        result ^= 1;
+        swap = seeValues[attacker] - swap;
+        if(swap < result) break;
+
+        occupied ^= squareBB(square);
+        if(attacker == PAWN || attacker == BISHOP || attacker == QUEEN) {
+            attackers |= Bitboards::bishopAttacks(to, occupied) & bishops;
+        }
+        if(attacker == ROOK || attacker == QUEEN) {
+            attackers |= Bitboards::rookAttacks(to, occupied) & rooks;
+        }
+    }
+    return result;
 }
 
 bool Board::makeMove(int fromX, int fromY, int toX, int toY, PieceType promotion) {
@@ -51,103 +415,209 @@ bool Board::makeMove(int fromX, int fromY, int toX, int toY, PieceType promotion
        toX < 0 || toX >= 8 || toY < 0 || toY >= 8) {
         return false;
     }
-    
-    Piece& piece = board[fromY][fromX];
-    bool isCapture = board[toY][toX].getType() != EMPTY;
-    
-    if(piece.getType() == EMPTY || 
+
+    int from = makeSquare(fromX, fromY);
+    int to = makeSquare(toX, toY);
+    Piece piece = mailbox[from];
+
+    if(piece.getType() == EMPTY ||
        (piece.getColor() == WHITE) != whiteToMove ||
-       !piece.isValidMove(fromX, fromY, toX, toY, isCapture)) {
+       !(pieceTargets(from) & squareBB(to))) {
         return false;
     }
-    
-    // Handle pawn promotion
-    if(piece.getType() == PAWN && (toY == 0 || toY == 7)) {
-        if(promotion == EMPTY) {
-            promotion = QUEEN; // Default promotion to queen
+
+    Move move(from, to);
+    if(isCastling(piece, from, to)) {
+        move = Move(from, to, CASTLING);
+    } else if(piece.getType() == PAWN && to == states[stateIndex].epSquare) {
+        move = Move(from, to, EN_PASSANT);
+    } else if(piece.getType() == PAWN && (toY == 0 || toY == 7)) {
+        // Handle pawn promotion, defaulting to a queen
+        if(promotion < KNIGHT || promotion > QUEEN) {
+            promotion = QUEEN;
         }
-        board[toY][toX] = Piece(promotion, piece.getColor());
-        board[fromY][fromX] = Piece();
-    } else {
-        // Make normal move
-        board[toY][toX] = piece;
-        board[fromY][fromX] = Piece();
+        move = Move(from, to, PROMOTION, promotion);
     }
-    
-    whiteToMove = !whiteToMove;
-    
-    // Check if the move puts own king in check
-    if(isCheck()) {
-        // Undo the move
-        board[fromY][fromX] = piece;
-        board[toY][toX] = Piece();
-        whiteToMove = !whiteToMove;
+
+    if(!isLegal(move)) {
         return false;
     }
-    
+
+    // Moves played on the game board are never taken back, so keep the
+    // whole state stack free for the search.
+    doMove(move);
+    states[0] = states[stateIndex];
+    stateIndex = 0;
     return true;
 }
 
-bool Board::isCheck() const {
-    // Find king position
-    int kingX = -1, kingY = -1;
-    Color currentColor = whiteToMove ? WHITE : BLACK;
-    
-    for(int y = 0; y < 8; y++) {
-        for(int x = 0; x < 8; x++) {
-            Piece piece = board[y][x];
-            if(piece.getType() == KING && piece.getColor() == currentColor) {
-                kingX = x;
-                kingY = y;
-                break;
+void Board::doMove(Move move) {
+    int from = move.getFrom();
+    int to = move.getTo();
+    Piece piece = mailbox[from];
+    Color us = piece.getColor();
+    Color them = opposite(us);
+
+    const StateInfo& prev = states[stateIndex];
+    StateInfo& st = states[++stateIndex];
+    st.captured = Piece();
+    st.castlingRights = prev.castlingRights & castlingMask(from) & castlingMask(to);
+    st.epSquare = NO_SQUARE;
+    st.halfmoveClock = static_cast<uint8_t>(std::min(prev.halfmoveClock + 1, 255));
+    st.pliesFromNull = static_cast<uint8_t>(std::min(prev.pliesFromNull + 1, 255));
+    st.pawnKey = prev.pawnKey;
+    st.materialKey = prev.materialKey;
+
+    uint64_t key = prev.key ^ Zobrist::keys.side
+                 ^ Zobrist::keys.castling[prev.castlingRights]
+                 ^ Zobrist::keys.castling[st.castlingRights];
+    if(prev.epSquare != NO_SQUARE) {
+        key ^= Zobrist::keys.enPassant[fileOf(prev.epSquare)];
+    }
+
+    if(move.getFlag() == CASTLING) {
+        bool kingSide = to > from;
+        int rookFrom = kingSide ? from + 3 : from - 4;
+        int rookTo = kingSide ? from + 1 : from - 1;
+        Piece rook = mailbox[rookFrom];
+        movePiece(from, to);
+        movePiece(rookFrom, rookTo);
+        key ^= Zobrist::psq(piece, from) ^ Zobrist::psq(piece, to)
+             ^ Zobrist::psq(rook, rookFrom) ^ Zobrist::psq(rook, rookTo);
+    } else {
+        int capSq = to;
+        if(move.getFlag() == EN_PASSANT) {
+            capSq = to + (us == WHITE ? -8 : 8);
+        }
+
+        Piece captured = mailbox[capSq];
+        if(captured.getType() != EMPTY) {
+            st.captured = captured;
+            st.halfmoveClock = 0;
+            removePiece(capSq);
+            key ^= Zobrist::psq(captured, capSq);
+            if(captured.getType() == PAWN) {
+                st.pawnKey ^= Zobrist::psq(captured, capSq);
             }
+            st.materialKey ^= Zobrist::keys.psq[them][captured.getType()][popCount(getPieces(captured.getType(), them))];
         }
-        if(kingX != -1) break;
-    }
-    
-    // Check if any opponent piece can capture the king
-    for(int y = 0; y < 8; y++) {
-        for(int x = 0; x < 8; x++) {
-            Piece piece = board[y][x];
-            if(piece.getType() != EMPTY && piece.getColor() != currentColor) {
-                if(piece.isValidMove(x, y, kingX, kingY, true)) {
-                    return true;
-                }
+        movePiece(from, to);
+        key ^= Zobrist::psq(piece, from) ^ Zobrist::psq(piece, to);
+
+        if(piece.getType() == PAWN) {
+            st.halfmoveClock = 0;
+            st.pawnKey ^= Zobrist::psq(piece, from) ^ Zobrist::psq(piece, to);
+            // Only record en passant when an enemy pawn can actually take
+            if(std::abs(to - from) == 16 &&
+               (Bitboards::pawnAttacks(us, (from + to) / 2) & byType[PAWN] & byColor[them])) {
+                st.epSquare = static_cast<uint8_t>((from + to) / 2);
+                key ^= Zobrist::keys.enPassant[fileOf(st.epSquare)];
+            }
+            if(move.getFlag() == PROMOTION) {
+                Piece promoted(move.getPromotion(), us);
+                removePiece(to);
+                putPiece(promoted, to);
+                key ^= Zobrist::psq(piece, to) ^ Zobrist::psq(promoted, to);
+                st.pawnKey ^= Zobrist::psq(piece, to);
+                st.materialKey ^= Zobrist::keys.psq[us][PAWN][popCount(getPieces(PAWN, us))]
+                                ^ Zobrist::keys.psq[us][promoted.getType()][popCount(getPieces(promoted.getType(), us)) - 1];
             }
         }
+        if(!byType[PAWN]) {
+            st.pawnKey = Zobrist::keys.noPawns;
+        }
     }
-    
-    return false;
+
+    st.key = key;
+    whiteToMove = !whiteToMove;
+    computeCheckers();
+    pushKeyHistory();
 }
 
-bool Board::isCheckmate() const {
-    if(!isCheck()) return false;
-    
-    // Try all possible moves
-    for(int fromY = 0; fromY < 8; fromY++) {
-        for(int fromX = 0; fromX < 8; fromX++) {
-            Piece piece = board[fromY][fromX];
-            if(piece.getType() != EMPTY && 
-               (piece.getColor() == WHITE) == whiteToMove) {
-                for(int toY = 0; toY < 8; toY++) {
-                    for(int toX = 0; toX < 8; toX++) {
-                        Board tempBoard = *this;
-                        if(tempBoard.makeMove(fromX, fromY, toX, toY)) {
-                            return false;
-                        }
-                    }
-                }
+void Board::undoMove(Move move) {
+    int from = move.getFrom();
+    int to = move.getTo();
+    const StateInfo& st = states[stateIndex];
+
+    whiteToMove = !whiteToMove;
+    Color us = getSideToMove();
+
+    if(move.getFlag() == PROMOTION) {
+        removePiece(to);
+        putPiece(Piece(PAWN, us), to);
+    }
+
+    if(move.getFlag() == CASTLING) {
+        bool kingSide = to > from;
+        movePiece(to, from);
+        movePiece(kingSide ? from + 1 : from - 1, kingSide ? from + 3 : from - 4);
+    } else {
+        movePiece(to, from);
+        if(st.captured.getType() != EMPTY) {
+            int capSq = to;
+            if(move.getFlag() == EN_PASSANT) {
+                capSq = to + (us == WHITE ? -8 : 8);
             }
+            putPiece(st.captured, capSq);
         }
     }
-    
-    return true;
+
+    stateIndex--;
+    gamePly--;
+}
+
+void Board::doNullMove() {
+    const StateInfo& prev = states[stateIndex];
+    StateInfo& st = states[++stateIndex];
+    st = prev;
+    st.captured = Piece();
+    st.checkers = 0;
+    st.key ^= Zobrist::keys.side;
+    if(prev.epSquare != NO_SQUARE) {
+        st.key ^= Zobrist::keys.enPassant[fileOf(prev.epSquare)];
+        st.epSquare = NO_SQUARE;
+    }
+    st.halfmoveClock = static_cast<uint8_t>(std::min(prev.halfmoveClock + 1, 255));
+    st.pliesFromNull = 0;
+
+    whiteToMove = !whiteToMove;
+    pushKeyHistory();
+}
+
+void Board::undoNullMove() {
+    whiteToMove = !whiteToMove;
+    stateIndex--;
+    gamePly--;
+}
+
+bool Board::isDraw(int ply) const {
+    if(states[stateIndex].halfmoveClock >= 100 && !isCheckmate()) {
+        return true;
+    }
+
+    // Within the search tree a single repetition is enough
+    int repetition = keyHistory[gamePly % KEY_HISTORY_SIZE].repetition;
+    return repetition != 0 && repetition < ply;
+}
+
+bool Board::isCheck() const {
+    return states[stateIndex].checkers != 0;
+}
+
+bool Board::isCheckmate() const {
+    return isCheck() && !MoveGen::hasLegalMove(*this);
 }
 
 void Board::setFromFEN(const std::string& fen) {
+    std::istringstream iss(fen);
+    std::string placement, side, castling, ep;
+    int halfmove = 0;
+    iss >> placement >> side >> castling >> ep >> halfmove;
+
+    clear();
     int x = 0, y = 7;
-    
-    for(char c : fen) {
+
+    for(char c : placement) {
         if(c == '/') {
             y--;
             x = 0;
@@ -159,7 +629,7 @@ void Board::setFromFEN(const std::string& fen) {
             PieceType type;
             Color color = (c >= 'A' && c <= 'Z') ? WHITE : BLACK;
             char piece = (color == WHITE) ? c : c - ('a' - 'A');
-            
+
             switch(piece) {
                 case 'P': type = PAWN; break;
                 case 'N': type = KNIGHT; break;
@@ -169,32 +639,65 @@ void Board::setFromFEN(const std::string& fen) {
                 case 'K': type = KING; break;
                 default: continue;
             }
-            
-            board[y][x] = Piece(type, color);
+
+            if(x < 8 && y >= 0) {
+                putPiece(Piece(type, color), makeSquare(x, y));
+            }
             x++;
         }
     }
+
+    whiteToMove = (side != "b");
+
+    StateInfo& st = states[0];
+    for(char c : castling) {
+        switch(c) {
+            case 'K': st.castlingRights |= WHITE_OO; break;
+            case 'Q': st.castlingRights |= WHITE_OOO; break;
+            case 'k': st.castlingRights |= BLACK_OO; break;
+            case 'q': st.castlingRights |= BLACK_OOO; break;
+        }
+    }
+    // Drop rights whose king or rook is not on its home square
+    for(int square : {0, 4, 7, 56, 60, 63}) {
+        PieceType expected = (square == 4 || square == 60) ? KING : ROOK;
+        Color color = square < 8 ? WHITE : BLACK;
+        if(mailbox[square].getType() != expected || mailbox[square].getColor() != color) {
+            st.castlingRights &= castlingMask(square);
+        }
+    }
+
+    if(ep.length() == 2 && ep[0] >= 'a' && ep[0] <= 'h' && (ep[1] == '3' || ep[1] == '6')) {
+        int epSquare = makeSquare(ep[0] - 'a', ep[1] - '1');
+        Color us = getSideToMove();
+        if(Bitboards::pawnAttacks(opposite(us), epSquare) & byType[PAWN] & byColor[us]) {
+            st.epSquare = static_cast<uint8_t>(epSquare);
+        }
+    }
+
+    st.halfmoveClock = static_cast<uint8_t>(std::min(std::max(halfmove, 0), 255));
+    st.pliesFromNull = st.halfmoveClock;
+    computeKeys();
+    computeCheckers();
 }
 
 std::vector<std::pair<int, int>> Board::getLegalMoves(int x, int y) const {
-    std::vector<std::pair<int, int>> moves;
+    std::vector<std::pair<int, int>> result;
     Piece piece = getPiece(x, y);
-    
+
     if(piece.getType() == EMPTY || (piece.getColor() == WHITE) != whiteToMove) {
-        return moves;
-    }
-    
-    for(int toY = 0; toY < 8; toY++) {
-        for(int toX = 0; toX < 8; toX++) {
-            bool isCapture = getPiece(toX, toY).getType() != EMPTY;
-            if(piece.isValidMove(x, y, toX, toY, isCapture)) {
-                Board tempBoard = *this;
-                if(tempBoard.makeMove(x, y, toX, toY)) {
-                    moves.emplace_back(toX, toY);
-                }
-            }
+        return result;
+    }
+
+    MoveList moves;
+    MoveGen::generate(LEGAL, *this, moves);
+    for(Move move : moves) {
+        // Promotions are listed once per destination
+        if(move.getFrom() == makeSquare(x, y) &&
+           (move.getPromotion() == EMPTY || move.getPromotion() == QUEEN)) {
+            result.emplace_back(fileOf(move.getTo()), rankOf(move.getTo()));
         }
     }
-    
-    return moves;
-} 
\ No newline at end of file
+
+    return result;
+}
@@ -1,187 +1,1103 @@
 #include "../include/engine.h"
+#include "../include/alloc_counter.h"
 #include "../include/evaluation.h"
+#include "../include/movegen.h"
 #include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
 #include <limits>
 #include <chrono>
 #include <iostream>
+#include <thread>
 
-Engine::Engine(int depth) : searchDepth(depth), stopSearch(false), 
-    hashSize(128), threadCount(1), multiPV(1), skillLevel(20), 
-    ponderEnabled(false), debugMode(false) {}
+namespace {
+
+// Mate scores are stored relative to the node so that they stay correct
+// when the position is reached again at a different ply
+int scoreToTT(int score, int ply) {
+    return score >= Engine::MATE_SCORE - MAX_PLY ? score + ply
+         : score <= -Engine::MATE_SCORE + MAX_PLY ? score - ply : score;
+}
+
+int scoreFromTT(int score, int ply) {
+    return score >= Engine::MATE_SCORE - MAX_PLY ? score - ply
+         : score <= -Engine::MATE_SCORE + MAX_PLY ? score + ply : score;
+}
+
+// UCI score: mates are given in moves, negative when we are the ones mated
+std::string scoreToString(int score) {
+    if(std::abs(score) >= Engine::MATE_SCORE - MAX_PLY) {
+        int plies = Engine::MATE_SCORE - std::abs(score);
+        int moves = (plies + 1) / 2;
+        return "mate " + std::to_string(score > 0 ? moves : -moves);
+    }
+    return "cp " + std::to_string(score);
+}
+
+} // namespace
+
+Engine::Engine(int depth) : defaultDepth(depth), searchDepth(depth), moveOverhead(10),
+    stopSearch(false), pondering(false), stopOnPonderhit(false), numaPolicy(Numa::POLICY_AUTO), searchGeneration(0),
+    helpersRunning(0), poolExit(false), perftTableMask(0),
+    hashSize(128), threadCount(1), multiPV(1), skillLevel(20),
+    ponderEnabled(false), debugMode(false), neverClearHash(false), evalCacheSize(1) {
+    evaluator.loadWeights("weights.bin");
+    tt.resize(hashSize);
+    setThreadCount(1);
+    initReductions();
+}
+
+void Engine::initReductions() {
+    for(int depth = 1; depth < 64; depth++) {
+        for(int moveCount = 1; moveCount < 64; moveCount++) {
+            reductions[depth][moveCount] = static_cast<int>(params.lmrBase / 100.0
+                + std::log(depth) * std::log(moveCount) / (params.lmrDivisor / 100.0));
+        }
+    }
+}
+
+// Selectivity tuning through setoption; the names are not announced by
+// "uci" because they are meant for tuning runs, not for users
+bool Engine::setSearchParam(const std::string& name, const std::string& value) {
+    struct Entry {
+        const char* name;
+        int* value;
+    };
+    const Entry entries[] = {
+        {"NullMinDepth", &params.nullMinDepth},
+        {"NullReduction", &params.nullReduction},
+        {"NullDepthDivisor", &params.nullDepthDivisor},
+        {"NullVerifyDepth", &params.nullVerifyDepth},
+        {"LmrBase", &params.lmrBase},
+        {"LmrDivisor", &params.lmrDivisor},
+        {"LmrMinDepth", &params.lmrMinDepth},
+        {"LmrMinMoves", &params.lmrMinMoves},
+        {"RfpMaxDepth", &params.rfpMaxDepth},
+        {"RfpMargin", &params.rfpMargin},
+        {"FutilityMaxDepth", &params.futilityMaxDepth},
+        {"FutilityBase", &params.futilityBase},
+        {"FutilityMargin", &params.futilityMargin},
+        {"LmpMaxDepth", &params.lmpMaxDepth},
+        {"LmpBase", &params.lmpBase},
+        {"SeeMaxDepth", &params.seeMaxDepth},
+        {"SeeQuietMargin", &params.seeQuietMargin},
+        {"SeeCaptureMargin", &params.seeCaptureMargin},
+        {"CheckExtension", &params.checkExtension},
+    };
+    
+    for(const Entry& entry : entries) {
+        if(name == entry.name) {
+            *entry.value = static_cast<int>(std::strtol(value.c_str(), nullptr, 10));
+            // Divisors must stay positive
+            params.nullDepthDivisor = std::max(1, params.nullDepthDivisor);
+            params.lmrDivisor = std::max(1, params.lmrDivisor);
+            initReductions();
+            return true;
+        }
+    }
+    return false;
+}
+
+Engine::~Engine() {
+    stopHelpers();
+}
+
+void Engine::setHashSize(int size) {
+    hashSize = std::max(TranspositionTable::MIN_SIZE_MB, std::min(size, TranspositionTable::MAX_SIZE_MB));
+    tt.resize(hashSize);
+    std::cout << "info string hash " << hashSize << " MB on " << tt.pageDescription() << std::endl;
+}
+
+// Takes over the size of the saved table; Hash is only a default
+bool Engine::loadHash(const std::string& filename) {
+    size_t megabytes = tt.load(filename);
+    if(megabytes) {
+        hashSize = static_cast<int>(megabytes);
+    }
+    return megabytes != 0;
+}
+
+void Engine::stopHelpers() {
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        poolExit = true;
+    }
+    poolCondition.notify_all();
+    for(std::thread& helper : helpers) {
+        helper.join();
+    }
+    helpers.clear();
+    poolExit = false;
+}
+
+// Rebuilds the pool; per-thread state is allocated here once rather than
+// at every search
+void Engine::setThreadCount(int count) {
+    stopHelpers();
+    threadCount = std::max(1, count);
+    tt.setThreadCount(threadCount);
+
+    // Every node in use gets its own copy of the network, made by a thread
+    // bound to it so that the pages are first touched, and placed, there
+    threadNodes = Numa::assignNodes(numaPolicy, threadCount);
+    tt.setThreadNodes(threadNodes);
+    std::vector<NNUE> nodeEvaluators(threadNodes.empty() ? 0 : Numa::nodeCount());
+    for(int node = 0; node < static_cast<int>(nodeEvaluators.size()); node++) {
+        if(std::find(threadNodes.begin(), threadNodes.end(), node) == threadNodes.end()) continue;
+        std::thread([this, &nodeEvaluators, node]() {
+            Numa::bindThisThread(node);
+            nodeEvaluators[node] = evaluator;
+            nodeEvaluators[node].replicateWeights();
+        }).join();
+    }
+    if(!threadNodes.empty()) {
+        std::cout << "info string binding " << threadCount << " threads to "
+                  << *std::max_element(threadNodes.begin(), threadNodes.end()) + 1 << " NUMA nodes" << std::endl;
+    }
+
+    searchInfos.clear();
+    for(int i = 0; i < threadCount; i++) {
+        std::unique_ptr<SearchInfo> info(new SearchInfo());
+        info->id = i;
+        info->evaluator = threadNodes.empty() ? evaluator : nodeEvaluators[threadNodes[i]];
+        info->history.reset(new SearchHistory());
+        info->history->clear();
+        allocateEvalCache(*info);
+        info->pv.reserve(MAX_PLY + 1);
+        searchInfos.push_back(std::move(info));
+    }
+
+    for(int i = 1; i < threadCount; i++) {
+        helpers.emplace_back(&Engine::helperLoop, this, i);
+    }
+}
+
+// Rounded down to a power of two entries so that the index is a mask
+void Engine::allocateEvalCache(SearchInfo& info) {
+    size_t entries = static_cast<size_t>(evalCacheSize) * 1024 * 1024 / sizeof(uint64_t);
+    while(entries & (entries - 1)) {
+        entries &= entries - 1;
+    }
+    info.evalCache.reset(entries ? new uint64_t[entries]() : nullptr);
+    info.evalCacheMask = entries ? entries - 1 : 0;
+}
+
+void Engine::setEvalCacheSize(int megabytes) {
+    evalCacheSize = std::max(0, megabytes);
+    for(auto& info : searchInfos) {
+        allocateEvalCache(*info);
+    }
+}
+
+void Engine::setNumaPolicy(const std::string& policy) {
+    numaPolicy = Numa::parsePolicy(policy);
+    setThreadCount(threadCount);
+}
+
+void Engine::helperLoop(int id) {
+    if(!threadNodes.empty()) {
+        Numa::bindThisThread(threadNodes[id]);
+    }
+    // Helpers rebuilt by a Threads change must not take the last search
+    // for a new one
+    std::unique_lock<std::mutex> lock(poolMutex);
+    uint64_t seen = searchGeneration;
+    while(true) {
+        poolCondition.wait(lock, [&]() { return poolExit || searchGeneration != seen; });
+        if(poolExit) return;
+        seen = searchGeneration;
+
+        lock.unlock();
+        iterativeDeepening(*searchInfos[id]);
+        lock.lock();
+
+        if(--helpersRunning == 0) {
+            poolCondition.notify_all();
+        }
+    }
+}
 
 void Engine::clearTables() {
-    // Reset transposition table if implemented
-    // Reset evaluation cache if implemented
-    // Reset any other tables or caches
     stopSearch = false;
-    
-    // Reset NNUE tables if necessary
-    evaluator = NNUE(); // Reinitialize NNUE
+    for(auto& info : searchInfos) {
+        info->history->clear();
+        if(info->evalCache) {
+            std::fill(info->evalCache.get(), info->evalCache.get() + info->evalCacheMask + 1, 0);
+        }
+    }
+    if(!neverClearHash) {
+        tt.clear();
+    }
 }
 
 Move Engine::getBestMove(const Board& board) {
-    stopSearch = false;
-    SearchInfo info = {0};
-    std::vector<Move> moves = generateAllMoves(board, board.isWhiteToMove());
-    
+    // The calling thread is new for every search
+    if(!threadNodes.empty()) {
+        Numa::bindThisThread(threadNodes[0]);
+    }
+    ponderMove = Move();
+    timeManager.init(limits, board.getSideToMove(), moveOverhead);
+    MoveList moves;
+    generateAllMoves(board, moves);
+
     if(moves.empty()) {
         return Move();
     }
-    
-    // Order moves for better pruning
+
+    // Order moves for better pruning, starting from the stored best move
     orderMoves(moves, board);
-    
+    tt.newSearch();
+    bool ttHit;
+    const TTEntry* rootEntry = tt.probe(board.getKey(), ttHit);
+    if(ttHit) {
+        moves.moveToFront(rootEntry->getMove());
+    }
+
+    // Every thread searches from its own copy of the root
+    for(auto& info : searchInfos) {
+        info->nodes = 0;
+        info->qnodes = 0;
+        info->evalProbes = 0;
+        info->evalHits = 0;
+        info->depth = 0;
+        info->score = -INFINITE_SCORE;
+        info->pollCountdown = 1;
+        info->nullMinPly = 0;
+        info->bestMove = moves[0];
+        info->pv.clear();
+        info->rootBoard = board;
+        info->evaluator.refreshAccumulator(board);
+        info->rootMoves = moves;
+        info->lines.resize(std::min(multiPV, moves.size()));
+        for(RootLine& line : info->lines) {
+            line.score = -INFINITE_SCORE;
+            line.length = 0;
+        }
+        for(SearchStack& entry : info->stack) {
+            entry = SearchStack();
+            entry.continuation = &info->history->continuation[0][0];
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        helpersRunning = threadCount - 1;
+        searchGeneration++;
+    }
+    poolCondition.notify_all();
+
+    SearchInfo& main = *searchInfos[0];
+    iterativeDeepening(main);
+
+    // A finished ponder or infinite search must not answer before the GUI
+    // sends stop or ponderhit
+    {
+        std::unique_lock<std::mutex> lock(poolMutex);
+        poolCondition.wait(lock, [this]() { return stopSearch || (!pondering && !limits.infinite); });
+    }
+
+    // Helpers stop as soon as the main thread is done
+    stopSearch = true;
+    {
+        std::unique_lock<std::mutex> lock(poolMutex);
+        poolCondition.wait(lock, [this]() { return helpersRunning == 0; });
+    }
+
+    // A helper that completed a deeper iteration has the better answer; its
+    // lines are reported so that bestmove matches the last PV the GUI saw
+    const SearchInfo* best = &main;
+    for(auto& info : searchInfos) {
+        if(info->depth > best->depth) {
+            best = info.get();
+        }
+    }
+    if(best != &main) {
+        printLines(*best, std::min(multiPV, best->rootMoves.size()));
+    }
+    ponderMove = best->pv.size() > 1 ? best->pv[1] : Move();
+    return best->bestMove;
+}
+
+void Engine::stopSearching() {
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        stopSearch = true;
+    }
+    poolCondition.notify_all();
+}
+
+// The opponent played the expected move: the running search carries on
+// with its TT and threads and only now starts answering to the clock.
+// Time spent pondering counts as spent, so a search that is already past
+// its budget answers at once.
+void Engine::ponderHit() {
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        pondering = false;
+        if(stopOnPonderhit) {
+            stopSearch = true;
+        }
+    }
+    poolCondition.notify_all();
+}
+
+void Engine::iterativeDeepening(SearchInfo& info) {
+    // Helpers skip depths in staggered patterns so that the threads spread
+    // over different iterations instead of duplicating each other
+    static const int skipSize[] = {1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4};
+    static const int skipPhase[] = {0, 1, 0, 1, 2, 3, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 6, 7};
+
+    MoveList& moves = info.rootMoves;
+    uint64_t allocationsBefore = AllocCounter::count();
+    double bestMoveChanges = 0;
+
     // Start iterative deepening
     for(int currentDepth = 1; currentDepth <= searchDepth; currentDepth++) {
         if(isTimeUp()) break;
-        
-        int alpha = -std::numeric_limits<int>::max();
-        int beta = std::numeric_limits<int>::max();
-        
-        Board tempBoard = board;
-        info.depth = currentDepth;
-        
-        for(const Move& move : moves) {
-            if(isTimeUp()) break;
+
+        if(info.id > 0) {
+            int i = (info.id - 1) % 20;
+            if(((currentDepth + skipPhase[i]) / skipSize[i]) % 2) continue;
+        }
+
+        // MultiPV: slot k searches the root with the best moves of the
+        // earlier slots excluded, so one pass yields the top lines while
+        // the slots share the TT and move ordering
+        int pvCount = std::min(multiPV, moves.size());
+        for(int pvIndex = 0; pvIndex < pvCount; pvIndex++) {
+            RootLine& line = info.lines[pvIndex];
             
-            tempBoard = board;
-            tempBoard.makeMove(move.fromX, move.fromY, move.toX, move.toY, move.promotion);
+            // Aspiration window: from the fifth iteration the search starts
+            // in a narrow window around the slot's last score and widens it
+            // on the side that failed
+            int delta = ASPIRATION_WINDOW;
+            int alpha = -INFINITE_SCORE;
+            int beta = INFINITE_SCORE;
+            if(currentDepth >= 5 && info.depth > 0) {
+                alpha = std::max(line.score - delta, -INFINITE_SCORE);
+                beta = std::min(line.score + delta, INFINITE_SCORE);
+            }
             
-            int score = -minimax(tempBoard, currentDepth - 1, -beta, -alpha, false, info);
+            int score;
+            while(true) {
+                score = searchRoot(info, currentDepth, pvIndex, alpha, beta);
+                if(isTimeUp()) break;
+                
+                if(score <= alpha && alpha > -INFINITE_SCORE) {
+                    beta = (alpha + beta) / 2;
+                    alpha = std::max(score - delta, -INFINITE_SCORE);
+                } else if(score >= beta && beta < INFINITE_SCORE) {
+                    beta = std::min(score + delta, INFINITE_SCORE);
+                    moves.moveToFront(info.pvTable[0][0], pvIndex);
+                } else {
+                    break;
+                }
+                delta += delta / 2;
+            }
+            if(isTimeUp()) break;
             
-            if(score > alpha) {
-                alpha = score;
-                info.pv.clear();
-                info.pv.push_back(move);
+            line.score = score;
+            line.length = info.pvLength[0];
+            std::copy(info.pvTable[0], info.pvTable[0] + line.length, line.pv);
+            if(line.length == 0) {
+                line.pv[line.length++] = moves[pvIndex];
+            }
+            moves.moveToFront(line.pv[0], pvIndex);
+        }
+        
+        // An interrupted iteration is not trusted
+        if(isTimeUp()) break;
+        
+        // A later slot can come out above an earlier one when the search is
+        // unstable; lines and root moves are kept in score order
+        for(int i = 1; i < pvCount; i++) {
+            for(int j = i; j > 0 && info.lines[j].score > info.lines[j - 1].score; j--) {
+                std::swap(info.lines[j], info.lines[j - 1]);
             }
         }
+        for(int i = pvCount - 1; i >= 0; i--) {
+            moves.moveToFront(info.lines[i].pv[0]);
+        }
         
+        const RootLine& best = info.lines[0];
+        Move iterationBest = best.pv[0];
+        int score = best.score;
+        
+        int previousScore = info.score;
+        bestMoveChanges = bestMoveChanges / 2 + (iterationBest != info.bestMove);
+        
+        info.depth = currentDepth;
+        info.bestMove = iterationBest;
+        info.score = score;
+        info.pv.assign(best.pv, best.pv + best.length);
+
         // Output search info
-        if(debugMode) {
-            std::cout << "info depth " << currentDepth 
-                      << " score cp " << alpha 
-                      << " nodes " << info.nodes 
-                      << " pv " << moveToString(info.pv[0]) << std::endl;
+        if(info.id == 0) {
+            printLines(info, pvCount);
+            
+            if(debugMode) {
+                uint64_t nodes = 0;
+                uint64_t qnodes = 0;
+                uint64_t evalProbes = 0;
+                uint64_t evalHits = 0;
+                for(auto& thread : searchInfos) {
+                    nodes += thread->nodes.load(std::memory_order_relaxed);
+                    qnodes += thread->qnodes.load(std::memory_order_relaxed);
+                    evalProbes += thread->evalProbes.load(std::memory_order_relaxed);
+                    evalHits += thread->evalHits.load(std::memory_order_relaxed);
+                }
+                info.allocations = AllocCounter::count() - allocationsBefore;
+                std::cout << "info string qsearch nodes " << qnodes << " ("
+                          << (nodes ? qnodes * 100 / nodes : 0) << "%)" << std::endl;
+                std::cout << "info string eval cache hits " << evalHits << " of " << evalProbes << " ("
+                          << (evalProbes ? evalHits * 100 / evalProbes : 0) << "%)" << std::endl;
+                if(AllocCounter::enabled) {
+                    std::cout << "info string search allocations " << info.allocations << std::endl;
+                }
+                allocationsBefore = AllocCounter::count();
+            }
+        }
+        
+        // Soft limit: stretched while the best move keeps changing or the
+        // score is falling, shrunk while both are settled. The next
+        // iteration usually outlasts everything spent so far, so none is
+        // started past half of it.
+        if(info.id == 0 && timeManager.isEnabled() && limits.movetime < 0 && currentDepth > 1) {
+            double instability = 0.7 + 0.6 * bestMoveChanges;
+            double falling = std::max(0.6, std::min(1.7, 1.0 + (previousScore - score) / 150.0));
+            if(timeManager.elapsed() >= timeManager.getOptimum() * instability * falling / 2) {
+                // While pondering the decision waits for ponderhit; the
+                // second check covers a ponderhit that raced with the store
+                if(pondering) {
+                    stopOnPonderhit = true;
+                    if(pondering) continue;
+                }
+                stopSearch = true;
+            }
         }
     }
-    
-    return !info.pv.empty() ? info.pv[0] : moves[0];
 }
 
-void Engine::setSearchParams(int depth, int movetime, int wtime, int btime, int winc, int binc) {
-    searchDepth = depth > 0 ? depth : searchDepth;
-    moveTime = movetime;
-    timeWhite = wtime;
-    timeBlack = btime;
-    incrementWhite = winc;
-    incrementBlack = binc;
+// Without an explicit depth, a search on the clock, a node budget or
+// "infinite" is bounded only by MAX_PLY; a bare "go" keeps the default
+// Called before the search thread starts, so that a stop or ponderhit sent
+// right after "go" is not lost
+void Engine::setSearchParams(const SearchLimits& searchLimits) {
+    limits = searchLimits;
+    stopSearch = false;
+    pondering = limits.ponder;
+    stopOnPonderhit = false;
+    if(limits.depth > 0) {
+        searchDepth = std::min(limits.depth, MAX_PLY - 1);
+    } else if(limits.usesClock() || limits.nodes || limits.infinite) {
+        searchDepth = MAX_PLY - 1;
+    } else {
+        searchDepth = defaultDepth;
+    }
 }
 
-bool Engine::isTimeUp() {
-    // Implement time management
-    return stopSearch;
+// One info line per MultiPV slot of the thread's last completed iteration
+void Engine::printLines(const SearchInfo& info, int pvCount) {
+    uint64_t nodes = totalNodes();
+    for(int i = 0; i < pvCount; i++) {
+        const RootLine& line = info.lines[i];
+        std::cout << "info depth " << info.depth
+                  << " multipv " << i + 1
+                  << " score " << scoreToString(line.score)
+                  << " nodes " << nodes
+                  << " hashfull " << tt.hashfull()
+                  << " pv";
+        for(int j = 0; j < line.length; j++) {
+            std::cout << " " << moveToString(line.pv[j]);
+        }
+        std::cout << std::endl;
+    }
+}
+
+uint64_t Engine::totalNodes() const {
+    uint64_t nodes = 0;
+    for(auto& info : searchInfos) {
+        nodes += info->nodes.load(std::memory_order_relaxed);
+    }
+    return nodes;
 }
 
-void Engine::orderMoves(std::vector<Move>& moves, const Board& board) {
+// Reading the clock costs far more than a node, so only the main thread
+// checks the hard limits, and only every few hundred nodes
+void Engine::pollTime(SearchInfo& info) {
+    if(info.id != 0 || --info.pollCountdown > 0) return;
+    info.pollCountdown = limits.nodes ? static_cast<int>(std::min<uint64_t>(1024, limits.nodes / 64 + 1)) : 1024;
+    
+    if((limits.nodes && totalNodes() >= limits.nodes)
+       || (timeManager.isEnabled() && !pondering.load(std::memory_order_relaxed)
+           && timeManager.elapsed() >= timeManager.getMaximum())) {
+        stopSearch = true;
+    }
+}
+
+void Engine::orderMoves(MoveList& moves, const Board& board) {
     // Score moves for ordering
-    for(Move& move : moves) {
+    for(int i = 0; i < moves.size(); i++) {
+        Move move = moves[i];
         int score = 0;
         
-        // MVV-LVA scoring
-        Piece captured = board.getPiece(move.toX, move.toY);
+        // MVV-LVA scoring, losing captures by how much they lose
+        Piece captured = board.getPiece(move.getTo());
         if(captured.getType() != EMPTY) {
-            score += 10 * captured.getValue();
+            score += board.seeGe(move, 0) ? 10 * captured.getValue() : board.see(move);
         }
         
         // Promotion scoring
-        if(move.promotion != EMPTY) {
+        if(move.getFlag() == PROMOTION) {
             score += 1000;
         }
         
-        move.score = score;
+        moves.scores[i] = score;
     }
     
     // Sort moves by score
-    std::sort(moves.rbegin(), moves.rend());
+    moves.sortByScore();
 }
 
-int Engine::minimax(Board& board, int depth, int alpha, int beta, bool maximizing, SearchInfo& info) {
+// Searches the root moves from firstMove on inside (alpha, beta): the
+// first with the full window, the others with a null window that is
+// reopened only for moves that beat alpha. The line is left in pvTable[0].
+int Engine::searchRoot(SearchInfo& info, int depth, int firstMove, int alpha, int beta) {
+    Board& rootBoard = info.rootBoard;
+    info.pvLength[0] = 0;
+    int moveCount = 0;
+    
+    for(int i = firstMove; i < info.rootMoves.size(); i++) {
+        Move move = info.rootMoves[i];
+        moveCount++;
+        SearchStack* ss = &info.stack[2];
+        ss->currentMove = move;
+        ss->continuation = &info.history->continuation[rootBoard.getPiece(move.getFrom()).getCode()][move.getTo()];
+        info.evaluator.pushAccumulator(rootBoard, move);
+        rootBoard.doMove(move);
+        int score;
+        if(moveCount == 1) {
+            score = -minimax(rootBoard, depth - 1, 1, -beta, -alpha, info);
+        } else {
+            score = -minimax(rootBoard, depth - 1, 1, -alpha - 1, -alpha, info);
+            if(score > alpha && score < beta) {
+                score = -minimax(rootBoard, depth - 1, 1, -beta, -alpha, info);
+            }
+        }
+        rootBoard.undoMove(move);
+        info.evaluator.popAccumulator();
+        
+        if(isTimeUp()) break;
+        
+        if(score > alpha) {
+            alpha = score;
+            updatePV(info, 0, move);
+            if(alpha >= beta) break;
+        }
+    }
+    return alpha;
+}
+
+// Triangular PV: the line at ply is the move played there followed by the
+// line the child left at ply + 1
+void Engine::updatePV(SearchInfo& info, int ply, Move move) {
+    info.pvTable[ply][ply] = move;
+    for(int i = ply + 1; i < info.pvLength[ply + 1]; i++) {
+        info.pvTable[ply][i] = info.pvTable[ply + 1][i];
+    }
+    info.pvLength[ply] = std::max(ply + 1, info.pvLength[ply + 1]);
+}
+
+int Engine::minimax(Board& board, int depth, int ply, int alpha, int beta, SearchInfo& info) {
+    info.pvLength[ply] = ply;
+    pollTime(info);
     if(isTimeUp()) return 0;
     
-    info.nodes++;
+    bool pvNode = beta - alpha > 1;
     
-    if(depth == 0) {
-        return evaluator.evaluate(board, maximizing);
+    if(depth <= 0) {
+        return qsearch(board, ply, alpha, beta, info);
     }
     
-    std::vector<Move> moves = generateAllMoves(board, maximizing);
-    if(moves.empty()) {
-        if(board.isCheck()) {
-            return maximizing ? -20000 : 20000; // Checkmate
+    info.countNode(info.nodes);
+    
+    if(board.isDraw(ply)) {
+        return 0;
+    }
+    
+    if(ply >= MAX_PLY) {
+        return evaluate(board, info);
+    }
+    
+#if defined(DEEPSQUARE_COUNT_ALLOCS)
+    // Nothing below this node may touch the heap
+    struct AllocationCheck {
+        uint64_t start = AllocCounter::count();
+        ~AllocationCheck() { assert(AllocCounter::count() == start); }
+    } allocationCheck;
+#endif
+    
+    // A stored result that is deep enough and whose bound fits the window
+    // ends the node without a search. PV nodes always search so that their
+    // line reaches the root.
+    bool ttHit;
+    TTEntry* ttEntry = tt.probe(board.getKey(), ttHit);
+    Move ttMove = ttHit ? ttEntry->getMove() : Move();
+    if(!pvNode && ttHit && ttEntry->getDepth() >= depth) {
+        int ttScore = scoreFromTT(ttEntry->getScore(), ply);
+        Bound bound = ttEntry->getBound();
+        if(bound == BOUND_EXACT || (bound == BOUND_LOWER && ttScore >= beta)
+           || (bound == BOUND_UPPER && ttScore <= alpha)) {
+            return ttScore;
         }
-        return 0; // Stalemate
     }
     
-    orderMoves(moves, board);
+    SearchStack* ss = &info.stack[ply + 2];
+    (ss + 2)->killers[0] = (ss + 2)->killers[1] = Move();
+    bool inCheck = board.isCheck();
+    
+    int staticEval = NO_EVAL;
+    if(!inCheck) {
+        staticEval = ttHit && ttEntry->getEval() != NO_EVAL ? ttEntry->getEval() : evaluate(board, info);
+    }
     
-    for(const Move& move : moves) {
-        board.makeMove(move.fromX, move.fromY, move.toX, move.toY, move.promotion);
-        int score = -minimax(board, depth - 1, -beta, -alpha, !maximizing, info);
-        board = board; // Undo move
+    if(!pvNode && !inCheck && std::abs(beta) < MATE_SCORE - MAX_PLY) {
+        // Reverse futility: so far above beta that no reply is expected to
+        // bring the score back down
+        if(depth <= params.rfpMaxDepth && staticEval - params.rfpMargin * depth >= beta) {
+            return staticEval;
+        }
         
-        if(maximizing) {
-            alpha = std::max(alpha, score);
-        } else {
-            beta = std::min(beta, score);
+        // Null move: if passing the turn still fails high, a real move will
+        // as well. Positions with only pawns left are skipped for fear of
+        // zugzwang.
+        Color us = board.getSideToMove();
+        Bitboard pieces = board.getPieces(us) & ~board.getPieces(PAWN) & ~board.getPieces(KING);
+        if(depth >= params.nullMinDepth && staticEval >= beta && pieces
+           && !(ss - 1)->nullMoved && ply >= info.nullMinPly) {
+            int reduction = params.nullReduction + depth / params.nullDepthDivisor;
+            ss->currentMove = Move();
+            ss->continuation = &info.history->continuation[0][0];
+            ss->nullMoved = true;
+            board.doNullMove();
+            tt.prefetch(board.getKey());
+            int score = -minimax(board, depth - reduction, ply + 1, -beta, -beta + 1, info);
+            board.undoNullMove();
+            ss->nullMoved = false;
+            
+            if(score >= beta) {
+                // A mate found after passing proves nothing
+                if(score >= MATE_SCORE - MAX_PLY) {
+                    score = beta;
+                }
+                if(depth < params.nullVerifyDepth || info.nullMinPly) {
+                    return score;
+                }
+                
+                // Deep nodes confirm with a reduced search that may not use
+                // null moves for its first few plies
+                info.nullMinPly = ply + 3 * (depth - reduction) / 4;
+                int verified = minimax(board, depth - reduction, ply, beta - 1, beta, info);
+                info.nullMinPly = 0;
+                if(verified >= beta) {
+                    return score;
+                }
+                info.pvLength[ply] = ply;
+            }
+        }
+    }
+    
+    Move prevMove = (ss - 1)->currentMove;
+    Move counterMove;
+    if(!prevMove.isNull()) {
+        counterMove = info.history->counterMoves[board.getPiece(prevMove.getTo()).getCode()][prevMove.getTo()];
+    }
+    const PieceToHistory* continuation[2] = {(ss - 1)->continuation, (ss - 2)->continuation};
+    MovePicker picker(board, ttMove, ss->killers, counterMove, *info.history, continuation);
+    
+    Move quietsTried[64];
+    int quietCount = 0;
+    int moveCount = 0;
+    int alphaOrig = alpha;
+    int bestScore = -INFINITE_SCORE;
+    Move bestMove;
+    
+    for(Move move = picker.next(); !move.isNull(); move = picker.next()) {
+        moveCount++;
+        bool quiet = !board.isCapture(move) && move.getPromotion() != QUEEN;
+        bool givesCheck = board.givesCheck(move);
+        
+        // Shallow pruning, once some move has been found that does not
+        // simply get mated
+        if(!inCheck && bestScore > -MATE_SCORE + MAX_PLY) {
+            if(quiet && !givesCheck) {
+                // Late move pruning: ordering puts the least promising
+                // quiets last, so past a depth-scaled count they are dropped
+                if(depth <= params.lmpMaxDepth && moveCount >= params.lmpBase + depth * depth) {
+                    picker.skipQuiets();
+                    continue;
+                }
+                
+                // Futility: even a generous positional gain stays below alpha
+                if(depth <= params.futilityMaxDepth
+                   && staticEval + params.futilityBase + params.futilityMargin * depth <= alpha) {
+                    continue;
+                }
+            }
+            
+            // Moves that lose material by more than a depth-scaled margin
+            if(depth <= params.seeMaxDepth
+               && !board.seeGe(move, quiet ? -params.seeQuietMargin * depth * depth
+                                           : -params.seeCaptureMargin * depth)) {
+                continue;
+            }
+        }
+        
+        int newDepth = depth - 1 + (givesCheck ? params.checkExtension : 0);
+        
+        ss->currentMove = move;
+        ss->continuation = &info.history->continuation[board.getPiece(move.getFrom()).getCode()][move.getTo()];
+        info.evaluator.pushAccumulator(board, move);
+        board.doMove(move);
+        tt.prefetch(board.getKey());
+        
+        // Late move reductions: later quiets get a shallower null-window
+        // search first and the full one only if they beat alpha
+        int reduction = 0;
+        if(quiet && depth >= params.lmrMinDepth && moveCount > params.lmrMinMoves) {
+            reduction = reductions[std::min(depth, 63)][std::min(moveCount, 63)];
+            if(pvNode || inCheck || givesCheck) {
+                reduction--;
+            }
+            reduction = std::max(0, std::min(reduction, newDepth - 1));
         }
         
-        if(beta <= alpha) {
+        // Principal variation search: only the first move of a PV node gets
+        // the full window. The rest are expected to fail low and are
+        // searched with a null window, reopened only when they do not.
+        int score = 0;
+        bool fullDepth = !pvNode || moveCount > 1;
+        if(reduction > 0) {
+            score = -minimax(board, newDepth - reduction, ply + 1, -alpha - 1, -alpha, info);
+            fullDepth = score > alpha;
+        }
+        if(fullDepth) {
+            score = -minimax(board, newDepth, ply + 1, -alpha - 1, -alpha, info);
+        }
+        if(pvNode && (moveCount == 1 || (score > alpha && score < beta))) {
+            score = -minimax(board, newDepth, ply + 1, -beta, -alpha, info);
+        }
+        board.undoMove(move);
+        info.evaluator.popAccumulator();
+        
+        if(score > bestScore) {
+            bestScore = score;
+        }
+        
+        if(score > alpha) {
+            alpha = score;
+            bestMove = move;
+            if(pvNode) {
+                updatePV(info, ply, move);
+            }
+        }
+        
+        if(alpha >= beta) {
+            if(quiet) {
+                updateQuietStats(board, info, ss, move, quietsTried, quietCount, depth);
+            }
             break;
         }
+        
+        if(quiet && quietCount < 64) {
+            quietsTried[quietCount++] = move;
+        }
+    }
+    
+    if(moveCount == 0) {
+        if(inCheck) {
+            return -MATE_SCORE + ply; // Checkmate
+        }
+        return 0; // Stalemate
     }
     
-    return maximizing ? alpha : beta;
+    // Scores from an aborted search are not worth keeping
+    if(isTimeUp()) return 0;
+    
+    Bound bound = alpha >= beta ? BOUND_LOWER : alpha > alphaOrig ? BOUND_EXACT : BOUND_UPPER;
+    ttEntry->save(board.getKey(), scoreToTT(alpha, ply), staticEval, bound, depth,
+                  bestMove, tt.getGeneration());
+    
+    return alpha;
 }
 
-std::vector<Move> Engine::generateAllMoves(const Board& board, bool forWhite) {
-    std::vector<Move> moves;
+// Resolves captures below the horizon so that leaves are scored in quiet
+// positions. The side to move may stand pat on the static evaluation
+// unless in check, in which case every evasion is searched.
+int Engine::qsearch(Board& board, int ply, int alpha, int beta, SearchInfo& info) {
+    pollTime(info);
+    if(isTimeUp()) return 0;
     
-    for(int fromY = 0; fromY < 8; fromY++) {
-        for(int fromX = 0; fromX < 8; fromX++) {
-            Piece piece = board.getPiece(fromX, fromY);
-            if(piece.getType() != EMPTY && (piece.getColor() == WHITE) == forWhite) {
-                auto legalMoves = board.getLegalMoves(fromX, fromY);
-                for(const auto& to : legalMoves) {
-                    moves.emplace_back(fromX, fromY, to.first, to.second);
-                }
+    info.countNode(info.nodes);
+    info.countNode(info.qnodes);
+    
+    if(board.isDraw(ply)) {
+        return 0;
+    }
+    
+    bool inCheck = board.isCheck();
+    if(ply >= MAX_PLY) {
+        return inCheck ? 0 : evaluate(board, info);
+    }
+    
+    bool ttHit;
+    TTEntry* ttEntry = tt.probe(board.getKey(), ttHit);
+    Move ttMove = ttHit ? ttEntry->getMove() : Move();
+    if(ttHit) {
+        int ttScore = scoreFromTT(ttEntry->getScore(), ply);
+        Bound bound = ttEntry->getBound();
+        if(bound == BOUND_EXACT || (bound == BOUND_LOWER && ttScore >= beta)
+           || (bound == BOUND_UPPER && ttScore <= alpha)) {
+            return ttScore;
+        }
+    }
+    
+    int standPat = -INFINITE_SCORE;
+    int staticEval = NO_EVAL;
+    if(!inCheck) {
+        staticEval = ttHit && ttEntry->getEval() != NO_EVAL ? ttEntry->getEval() : evaluate(board, info);
+        standPat = staticEval;
+        if(standPat >= beta) {
+            if(!ttHit) {
+                ttEntry->save(board.getKey(), scoreToTT(standPat, ply), staticEval, BOUND_LOWER,
+                              DEPTH_QS, Move(), tt.getGeneration());
             }
+            return standPat;
+        }
+        if(standPat > alpha) {
+            alpha = standPat;
         }
     }
     
-    return moves;
+    SearchStack* ss = &info.stack[ply + 2];
+    const PieceToHistory* continuation[2] = {(ss - 1)->continuation, (ss - 2)->continuation};
+    MovePicker picker(board, ttMove, *info.history, continuation);
+    int moveCount = 0;
+    int alphaOrig = alpha;
+    Move bestMove;
+    
+    for(Move move = picker.next(); !move.isNull(); move = picker.next()) {
+        moveCount++;
+        
+        if(!inCheck) {
+            // Delta pruning: not even winning the piece outright gets close to alpha
+            Piece captured = move.getFlag() == EN_PASSANT ? Piece(PAWN, WHITE) : board.getPiece(move.getTo());
+            if(move.getPromotion() != QUEEN && standPat + captured.getValue() + DELTA_MARGIN <= alpha) {
+                continue;
+            }
+            
+            // Captures that lose material are not worth resolving
+            if(!board.seeGe(move, 0)) {
+                continue;
+            }
+        }
+        
+        ss->currentMove = move;
+        ss->continuation = &info.history->continuation[board.getPiece(move.getFrom()).getCode()][move.getTo()];
+        info.evaluator.pushAccumulator(board, move);
+        board.doMove(move);
+        tt.prefetch(board.getKey());
+        int score = -qsearch(board, ply + 1, -beta, -alpha, info);
+        board.undoMove(move);
+        info.evaluator.popAccumulator();
+        
+        if(score > alpha) {
+            alpha = score;
+            bestMove = move;
+        }
+        
+        if(alpha >= beta) {
+            break;
+        }
+    }
+    
+    if(inCheck && moveCount == 0) {
+        return -MATE_SCORE + ply; // Checkmate
+    }
+    
+    if(isTimeUp()) return 0;
+    
+    Bound bound = alpha >= beta ? BOUND_LOWER : alpha > alphaOrig ? BOUND_EXACT : BOUND_UPPER;
+    ttEntry->save(board.getKey(), scoreToTT(alpha, ply), staticEval, bound, DEPTH_QS,
+                  bestMove, tt.getGeneration());
+    
+    return alpha;
+}
+
+// Rewards the quiet move that failed high and penalizes the quiets tried
+// before it at the same node
+void Engine::updateQuietStats(const Board& board, SearchInfo& info, SearchStack* ss, Move move,
+                              const Move* quietsTried, int quietCount, int depth) {
+    if(ss->killers[0] != move) {
+        ss->killers[1] = ss->killers[0];
+        ss->killers[0] = move;
+    }
+    
+    Move prevMove = (ss - 1)->currentMove;
+    if(!prevMove.isNull()) {
+        info.history->counterMoves[board.getPiece(prevMove.getTo()).getCode()][prevMove.getTo()] = move;
+    }
+    
+    int bonus = std::min(32 * depth * depth, 1600);
+    updateContinuation(board, info, ss, move, bonus);
+    for(int i = 0; i < quietCount; i++) {
+        updateContinuation(board, info, ss, quietsTried[i], -bonus);
+    }
+}
+
+void Engine::updateContinuation(const Board& board, SearchInfo& info, SearchStack* ss, Move move, int bonus) {
+    Color us = board.getSideToMove();
+    int piece = board.getPiece(move.getFrom()).getCode();
+    int to = move.getTo();
+    
+    updateHistory(info.history->butterfly[us][move.getFrom()][to], bonus);
+    for(int i = 1; i <= 2; i++) {
+        // The sentinel table behind a missing move stays zero
+        if(!(ss - i)->currentMove.isNull()) {
+            updateHistory((*(ss - i)->continuation)[piece][to], bonus);
+        }
+    }
+}
+
+// Positions whose TT entry was overwritten, or that transpose into each
+// other, are evaluated again and again; the cache answers them before any
+// accumulator work
+int Engine::evaluate(const Board& board, SearchInfo& info) {
+    uint64_t* slot = nullptr;
+    uint64_t tag = board.getKey() & ~0xFFFFULL;
+    if(info.evalCache) {
+        info.countNode(info.evalProbes);
+        slot = &info.evalCache[board.getKey() & info.evalCacheMask];
+        if((*slot & ~0xFFFFULL) == tag) {
+            info.countNode(info.evalHits);
+            return static_cast<int16_t>(*slot & 0xFFFF);
+        }
+    }
+
+    int eval = info.evaluator.isLoaded() ? info.evaluator.evaluate(board, board.isWhiteToMove())
+                                         : Evaluation::evaluateMaterial(board);
+    if(slot) {
+        *slot = tag | static_cast<uint16_t>(eval);
+    }
+    return eval;
+}
+
+void Engine::generateAllMoves(const Board& board, MoveList& moves) {
+    moves.clear();
+    MoveGen::generate(LEGAL, board, moves);
+}
+
+void Engine::setPerftHashSize(int megabytes) {
+    perftTable.reset();
+    perftTableMask = 0;
+    if(megabytes <= 0) return;
+    
+    // Round down to a power of two so the key can be masked
+    size_t entries = (static_cast<size_t>(megabytes) << 20) / sizeof(PerftEntry);
+    size_t size = 1;
+    while(size * 2 <= entries) size *= 2;
+    perftTable.reset(new PerftEntry[size]());
+    perftTableMask = size - 1;
 }
 
 uint64_t Engine::perft(Board& board, int depth) {
-    if(depth == 0) return 1;
+    MoveList moves;
+    generateAllMoves(board, moves);
     
-    uint64_t nodes = 0;
-    std::vector<Move> moves = generateAllMoves(board, board.isWhiteToMove());
+    // Bulk counting: the leaves are exactly the legal moves
+    if(depth == 1) return moves.size();
     
-    for(const Move& move : moves) {
-        Board tempBoard = board;
-        if(tempBoard.makeMove(move.fromX, move.fromY, move.toX, move.toY)) {
-            nodes += perft(tempBoard, depth - 1);
+    // Entries pack count << 8 | depth and are checked against key ^ data,
+    // so a torn write from another thread reads as a miss
+    PerftEntry* entry = nullptr;
+    if(perftTable) {
+        entry = &perftTable[board.getKey() & perftTableMask];
+        uint64_t data = entry->data.load(std::memory_order_relaxed);
+        uint64_t check = entry->check.load(std::memory_order_relaxed);
+        if((data & 0xFF) == static_cast<uint64_t>(depth) && (check ^ data) == board.getKey()) {
+            return data >> 8;
         }
     }
     
+    uint64_t nodes = 0;
+    for(Move move : moves) {
+        board.doMove(move);
+        nodes += perft(board, depth - 1);
+        board.undoMove(move);
+    }
+    
+    if(entry) {
+        uint64_t data = nodes << 8 | static_cast<uint64_t>(depth);
+        entry->data.store(data, std::memory_order_relaxed);
+        entry->check.store(board.getKey() ^ data, std::memory_order_relaxed);
+    }
+    
     return nodes;
 }
 
-std::string Engine::moveToString(const Move& move) {
-    std::string result;
-    result += static_cast<char>('a' + move.fromX);
-    result += static_cast<char>('1' + move.fromY);
-    result += static_cast<char>('a' + move.toX);
-    result += static_cast<char>('1' + move.toY);
-    return result;
-}
\ No newline at end of file
+uint64_t Engine::divide(const Board& board, int depth) {
+    auto start = std::chrono::steady_clock::now();
+    
+    // Deeper lines would overrun the board's state stack
+    depth = std::min(depth, MAX_PLY - 1);
+    MoveList moves;
+    if(depth > 0) {
+        generateAllMoves(board, moves);
+    }
+    uint64_t counts[MoveList::CAPACITY] = {};
+    
+    // Root moves are handed out to the threads one at a time
+    std::atomic<int> nextMove(0);
+    auto worker = [&]() {
+        Board local = board;
+        for(int i = nextMove++; i < moves.size(); i = nextMove++) {
+            if(depth == 1) {
+                counts[i] = 1;
+                continue;
+            }
+            local.doMove(moves[i]);
+            counts[i] = perft(local, depth - 1);
+            local.undoMove(moves[i]);
+        }
+    };
+    
+    int threads = std::max(1, std::min(threadCount, moves.size()));
+    std::vector<std::thread> helpers;
+    for(int i = 1; i < threads; i++) {
+        helpers.emplace_back(worker);
+    }
+    worker();
+    for(std::thread& helper : helpers) {
+        helper.join();
+    }
+    
+    // At depth 0 the root itself is the only leaf
+    uint64_t total = depth > 0 ? 0 : 1;
+    for(int i = 0; i < moves.size(); i++) {
+        std::cout << moveToString(moves[i]) << ": " << counts[i] << std::endl;
+        total += counts[i];
+    }
+    
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    std::cout << std::endl << "Nodes searched: " << total << std::endl;
+    std::cout << "info string perft time " << elapsed << " ms nps "
+              << total * 1000 / std::max<int64_t>(elapsed, 1) << std::endl;
+    
+    return total;
+}
+
+std::string Engine::moveToString(Move move) {
+    return move.toString();
+}
@@ -1,16 +1,17 @@
 #include "../include/evaluation.h"
-#include "../include/nnue.h"
 
-int Evaluation::evaluatePosition(const Board& board) {
-    static NNUE nnue;
-    static bool initialized = false;
-    
-    if(!initialized) {
-        nnue.loadWeights("weights.bin");
-        initialized = true;
+// Material and pawn placement from the side to move's point of view. Used
+// whenever no network has been loaded.
+int Evaluation::evaluateMaterial(const Board& board) {
+    int score = 0;
+    Bitboard pieces = board.getOccupied() & ~board.getPieces(KING);
+    while(pieces) {
+        int square = popLsb(pieces);
+        Piece piece = board.getPiece(square);
+        int value = getPieceValue(piece) + getPositionalValue(piece, fileOf(square), rankOf(square));
+        score += piece.getColor() == WHITE ? value : -value;
     }
-    
-    return nnue.evaluate(board, board.isWhiteToMove());
+    return board.isWhiteToMove() ? score : -score;
 }
 
 int Evaluation::getPieceValue(const Piece& piece) {
@@ -30,7 +31,7 @@ int Evaluation::getPositionalValue(const Piece& piece, int x, int y) {
     };
     
     if(piece.getType() == PAWN) {
-        return pawnTable[piece.getColor() == WHITE ? y : 7-y][x];
+        return pawnTable[piece.getColor() == WHITE ? 7-y : y][x];
     }
     
     return 0;
@@ -1,14 +1,61 @@
 #include "../include/move.h"
 
-Move::Move(int fx, int fy, int tx, int ty, int s) {
-    fromX = fx;
-    fromY = fy;
-    toX = tx;
-    toY = ty;
-    promotion = EMPTY;
-    score = s;
-}
-
-bool Move::operator<(const Move& other) const {
-    return score < other.score;
-} 
\ No newline at end of file
+std::string Move::toString() const {
+    if(isNull()) {
+        return "0000";
+    }
+
+    std::string result;
+    result += static_cast<char>('a' + (getFrom() & 7));
+    result += static_cast<char>('1' + (getFrom() >> 3));
+    result += static_cast<char>('a' + (getTo() & 7));
+    result += static_cast<char>('1' + (getTo() >> 3));
+    switch(getPromotion()) {
+        case KNIGHT: result += 'n'; break;
+        case BISHOP: result += 'b'; break;
+        case ROOK: result += 'r'; break;
+        case QUEEN: result += 'q'; break;
+        default: break;
+    }
+    return result;
+}
+
+bool MoveList::contains(Move move) const {
+    for(int i = 0; i < count; i++) {
+        if(moves[i] == move) return true;
+    }
+    return false;
+}
+
+// Moves it to index first, keeping the relative order of the other moves;
+// the moves in front of first are left alone
+void MoveList::moveToFront(Move move, int first) {
+    for(int i = first; i < count; i++) {
+        if(moves[i] == move) {
+            int score = scores[i];
+            for(int j = i; j > first; j--) {
+                moves[j] = moves[j - 1];
+                scores[j] = scores[j - 1];
+            }
+            moves[first] = move;
+            scores[first] = score;
+            return;
+        }
+    }
+}
+
+// Stable insertion sort, best score first
+void MoveList::sortByScore() {
+    for(int i = 1; i < count; i++) {
+        Move move = moves[i];
+        int score = scores[i];
+        int j = i - 1;
+        while(j >= 0 && scores[j] < score) {
+            moves[j + 1] = moves[j];
+            scores[j + 1] = scores[j];
+            j--;
+        }
+        moves[j + 1] = move;
+        scores[j + 1] = score;
+    }
+}
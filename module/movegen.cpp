@@ -0,0 +1,186 @@
+#include "../include/movegen.h"
+
+namespace {
+
+inline Color opposite(Color c) {
+    return c == WHITE ? BLACK : WHITE;
+}
+
+inline Bitboard shiftUp(Bitboard b, Color us) {
+    return us == WHITE ? b << 8 : b >> 8;
+}
+
+// Pawn captures towards the a-file and towards the h-file
+inline Bitboard shiftWest(Bitboard b, Color us) {
+    b &= ~FILE_A_BB;
+    return us == WHITE ? b << 7 : b >> 9;
+}
+
+inline Bitboard shiftEast(Bitboard b, Color us) {
+    b &= ~FILE_H_BB;
+    return us == WHITE ? b << 9 : b >> 7;
+}
+
+// Runs emit(move) for every legal move of the requested kind and stops as
+// soon as it returns true; the return value tells whether that happened.
+template<GenType Type, typename Emit>
+bool generateMoves(const Board& board, Emit emit) {
+    Color us = board.getSideToMove();
+    Color them = opposite(us);
+    int ksq = board.getKingSquare(us);
+    Bitboard occupied = board.getOccupied();
+    Bitboard ours = board.getPieces(us);
+    Bitboard theirs = board.getPieces(them);
+    Bitboard checkers = board.getCheckers();
+
+    // King moves first: they are the only option under double check
+    Bitboard kingTargets = Bitboards::kingAttacks(ksq) & ~ours;
+    if(Type == CAPTURES) kingTargets &= theirs;
+    if(Type == QUIETS) kingTargets &= ~occupied;
+    while(kingTargets) {
+        int to = popLsb(kingTargets);
+        if(!(board.attackersTo(to, occupied ^ squareBB(ksq)) & theirs)) {
+            if(emit(Move(ksq, to))) return true;
+        }
+    }
+
+    if(moreThanOne(checkers)) {
+        return false;
+    }
+
+    // Squares that resolve a single check; everything when not in check
+    Bitboard checkMask = checkers ? Bitboards::between(ksq, lsb(checkers)) | checkers : ~0ULL;
+    Bitboard pinned = MoveGen::pinnedPieces(board, us);
+
+    Bitboard target = Type == CAPTURES ? theirs : Type == QUIETS ? ~occupied : ~ours;
+    target &= checkMask;
+
+    for(PieceType type : {KNIGHT, BISHOP, ROOK, QUEEN}) {
+        Bitboard pieces = board.getPieces(type, us);
+        while(pieces) {
+            int from = popLsb(pieces);
+            Bitboard targets = Bitboards::attacks(type, from, occupied) & target;
+            if(pinned & squareBB(from)) {
+                targets &= Bitboards::line(ksq, from);
+            }
+            while(targets) {
+                if(emit(Move(from, popLsb(targets)))) return true;
+            }
+        }
+    }
+
+    int up = us == WHITE ? 8 : -8;
+    Bitboard pawns = board.getPieces(PAWN, us);
+    Bitboard lastRank = us == WHITE ? RANK_8_BB : RANK_1_BB;
+    Bitboard thirdRank = us == WHITE ? RANK_1_BB << 16 : RANK_1_BB << 40;
+    Bitboard empty = ~occupied;
+
+    auto pawnMove = [&](int from, int to) {
+        return !(pinned & squareBB(from)) || Bitboards::aligned(ksq, from, to);
+    };
+
+    auto emitPawn = [&](Bitboard targets, int delta) {
+        while(targets) {
+            int to = popLsb(targets);
+            int from = to - delta;
+            if(!pawnMove(from, to)) continue;
+            if(squareBB(to) & lastRank) {
+                if(Type != QUIETS && emit(Move(from, to, PROMOTION, QUEEN))) return true;
+                if(Type != CAPTURES) {
+                    for(PieceType promotion : {KNIGHT, ROOK, BISHOP}) {
+                        if(emit(Move(from, to, PROMOTION, promotion))) return true;
+                    }
+                }
+            } else if(emit(Move(from, to))) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    // Pushes; only promotions are generated as captures-stage moves
+    Bitboard single = shiftUp(pawns, us) & empty;
+    Bitboard twice = shiftUp(single & thirdRank, us) & empty & checkMask;
+    single &= checkMask;
+    if(Type == CAPTURES) {
+        single &= lastRank;
+    } else if(emitPawn(twice, 2 * up)) {
+        return true;
+    }
+    if(emitPawn(single, up)) return true;
+
+    // Captures; under QUIETS only their under-promotions are wanted
+    Bitboard victims = theirs & checkMask;
+    if(Type == QUIETS) victims &= lastRank;
+    if(emitPawn(shiftWest(pawns, us) & victims, us == WHITE ? 7 : -9)) return true;
+    if(emitPawn(shiftEast(pawns, us) & victims, us == WHITE ? 9 : -7)) return true;
+
+    int epSquare = board.getEpSquare();
+    if(Type != QUIETS && epSquare != NO_SQUARE) {
+        Bitboard candidates = Bitboards::pawnAttacks(them, epSquare) & pawns;
+        while(candidates) {
+            Move move(popLsb(candidates), epSquare, EN_PASSANT);
+            if(board.isLegal(move) && emit(move)) return true;
+        }
+    }
+
+    if(Type != CAPTURES && !checkers) {
+        int home = us == WHITE ? 4 : 60;
+        int rights = board.getCastlingRights() & (us == WHITE ? (WHITE_OO | WHITE_OOO) : (BLACK_OO | BLACK_OOO));
+        if(ksq == home && rights) {
+            if((rights & (WHITE_OO | BLACK_OO)) && !(occupied & Bitboards::between(home, home + 3))
+               && !board.isSquareAttacked(home + 1, them) && !board.isSquareAttacked(home + 2, them)) {
+                if(emit(Move(home, home + 2, CASTLING))) return true;
+            }
+            if((rights & (WHITE_OOO | BLACK_OOO)) && !(occupied & Bitboards::between(home, home - 4))
+               && !board.isSquareAttacked(home - 1, them) && !board.isSquareAttacked(home - 2, them)) {
+                if(emit(Move(home, home - 2, CASTLING))) return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+} // namespace
+
+namespace MoveGen {
+
+void generate(GenType type, const Board& board, MoveList& moves) {
+    auto emit = [&moves](Move move) {
+        moves.add(move);
+        return false;
+    };
+
+    switch(type) {
+        case CAPTURES: generateMoves<CAPTURES>(board, emit); break;
+        case QUIETS: generateMoves<QUIETS>(board, emit); break;
+        case LEGAL: generateMoves<LEGAL>(board, emit); break;
+    }
+}
+
+bool hasLegalMove(const Board& board) {
+    return generateMoves<LEGAL>(board, [](Move) { return true; });
+}
+
+// Our pieces that are the only blocker between an enemy slider and our king
+Bitboard pinnedPieces(const Board& board, Color color) {
+    int ksq = board.getKingSquare(color);
+    Color them = opposite(color);
+    Bitboard occupied = board.getOccupied();
+
+    Bitboard snipers = ((Bitboards::rookAttacks(ksq, 0) & (board.getPieces(ROOK) | board.getPieces(QUEEN)))
+                     | (Bitboards::bishopAttacks(ksq, 0) & (board.getPieces(BISHOP) | board.getPieces(QUEEN))))
+                     & board.getPieces(them);
+
+    Bitboard pinned = 0;
+    while(snipers) {
+        Bitboard blockers = Bitboards::between(ksq, popLsb(snipers)) & occupied;
+        if(blockers && !moreThanOne(blockers)) {
+            pinned |= blockers & board.getPieces(color);
+        }
+    }
+    return pinned;
+}
+
+} // namespace MoveGen
@@ -0,0 +1,173 @@
+#include "../include/movepick.h"
+#include "../include/movegen.h"
+#include <cstring>
+
+namespace {
+    const Move noKillers[2] = {};
+}
+
+void SearchHistory::clear() {
+    std::memset(butterfly, 0, sizeof(butterfly));
+    std::memset(continuation, 0, sizeof(continuation));
+    for(auto& row : counterMoves) {
+        for(Move& move : row) {
+            move = Move();
+        }
+    }
+}
+
+MovePicker::MovePicker(const Board& board, Move ttMove, const Move killers[2], Move counterMove,
+                       const SearchHistory& history, const PieceToHistory* const continuation[2])
+    : board(board), history(history), ttMove(ttMove), current(0), badCaptures(0), stage(TT_MOVE), capturesOnly(false), quietsSkipped(false) {
+    this->continuation[0] = continuation[0];
+    this->continuation[1] = continuation[1];
+    refutations[0] = killers[0];
+    refutations[1] = killers[1];
+    refutations[2] = counterMove;
+
+    if(this->ttMove.isNull() || !board.isPseudoLegal(this->ttMove) || !board.isLegal(this->ttMove)) {
+        this->ttMove = Move();
+        stage = CAPTURE_INIT;
+    }
+}
+
+MovePicker::MovePicker(const Board& board, Move ttMove,
+                       const SearchHistory& history, const PieceToHistory* const continuation[2])
+    : MovePicker(board, ttMove, noKillers, Move(), history, continuation) {
+    capturesOnly = !board.isCheck();
+
+    // A quiet hash move is not searched outside of check
+    if(capturesOnly && !this->ttMove.isNull() && !board.isCapture(this->ttMove)
+       && this->ttMove.getPromotion() != QUEEN) {
+        this->ttMove = Move();
+        stage = CAPTURE_INIT;
+    }
+}
+
+// Only quiet moves qualify, and each one is tried once
+bool MovePicker::isUsableRefutation(Move move) const {
+    return !move.isNull() && move != ttMove && !board.isCapture(move) && move.getPromotion() != QUEEN
+        && board.isPseudoLegal(move) && board.isLegal(move);
+}
+
+bool MovePicker::isRefutation(Move move) const {
+    return move == refutations[0] || move == refutations[1] || move == refutations[2];
+}
+
+void MovePicker::scoreCaptures() {
+    for(int i = 0; i < moves.size(); i++) {
+        Move move = moves[i];
+        Piece victim = move.getFlag() == EN_PASSANT ? Piece(PAWN, WHITE) : board.getPiece(move.getTo());
+        int score = 16 * victim.getValue() - board.getPiece(move.getFrom()).getType();
+        if(move.getPromotion() == QUEEN) {
+            score += 16 * Piece(QUEEN, WHITE).getValue();
+        }
+        moves.scores[i] = score;
+    }
+}
+
+void MovePicker::scoreQuiets() {
+    Color us = board.getSideToMove();
+    for(int i = badCaptures; i < moves.size(); i++) {
+        Move move = moves[i];
+        int piece = board.getPiece(move.getFrom()).getCode();
+        int to = move.getTo();
+        moves.scores[i] = history.butterfly[us][move.getFrom()][to]
+                        + (*continuation[0])[piece][to]
+                        + (*continuation[1])[piece][to];
+    }
+}
+
+// Selection rather than a full sort: most nodes stop after a few moves
+Move MovePicker::pickBest() {
+    int best = current;
+    for(int i = current + 1; i < moves.size(); i++) {
+        if(moves.scores[i] > moves.scores[best]) {
+            best = i;
+        }
+    }
+    Move move = moves[best];
+    moves[best] = moves[current];
+    moves.scores[best] = moves.scores[current];
+    current++;
+    return move;
+}
+
+Move MovePicker::next() {
+    switch(stage) {
+        case TT_MOVE:
+            stage = CAPTURE_INIT;
+            return ttMove;
+
+        case CAPTURE_INIT:
+            moves.clear();
+            MoveGen::generate(CAPTURES, board, moves);
+            scoreCaptures();
+            current = 0;
+            stage = GOOD_CAPTURES;
+            [[fallthrough]];
+
+        case GOOD_CAPTURES:
+            while(current < moves.size()) {
+                Move move = pickBest();
+                if(move == ttMove) continue;
+                if(capturesOnly || board.seeGe(move, 0)) return move;
+                // Parked at the front of the list for the last stage
+                moves[badCaptures++] = move;
+            }
+            if(capturesOnly) {
+                stage = DONE;
+                return Move();
+            }
+            stage = KILLER_1;
+            [[fallthrough]];
+
+        case KILLER_1:
+        case KILLER_2:
+        case COUNTER_MOVE:
+            while(stage <= COUNTER_MOVE && !quietsSkipped) {
+                int index = stage - KILLER_1;
+                Move move = refutations[index];
+                stage++;
+                bool repeated = (index > 0 && move == refutations[0]) || (index > 1 && move == refutations[1]);
+                if(!repeated && isUsableRefutation(move)) return move;
+                // Not played here, so the quiet stage must not skip it
+                refutations[index] = Move();
+            }
+            [[fallthrough]];
+
+        case QUIET_INIT:
+            if(quietsSkipped) {
+                current = 0;
+                stage = BAD_CAPTURES;
+                return next();
+            }
+            // Quiets go behind the parked losing captures
+            moves.count = badCaptures;
+            MoveGen::generate(QUIETS, board, moves);
+            scoreQuiets();
+            current = badCaptures;
+            stage = QUIETS_STAGE;
+            [[fallthrough]];
+
+        case QUIETS_STAGE:
+            while(current < moves.size() && !quietsSkipped) {
+                Move move = pickBest();
+                if(move != ttMove && !isRefutation(move)) return move;
+            }
+            current = 0;
+            stage = BAD_CAPTURES;
+            [[fallthrough]];
+
+        case BAD_CAPTURES:
+            if(current < badCaptures) {
+                return moves[current++];
+            }
+            stage = DONE;
+            [[fallthrough]];
+
+        case DONE:
+            break;
+    }
+    return Move();
+}
@@ -2,24 +2,34 @@
 #include <fstream>
 #include <cmath>
 #include <algorithm>
+#include <cassert>
 
 using namespace simd;
 
-NNUE::NNUE() : accumulatorStackSize(0) {
-    accumulator[0].computed = false;
-    accumulator[1].computed = false;
+namespace {
+
+// int16 lanes per vector register
+constexpr int LANES = sizeof(vec_type) / sizeof(int16_t);
+
+} // namespace
+
+NNUE::NNUE() : stack(new Accumulator[STACK_SIZE]), stackTop(0), refreshTable(new RefreshEntry[2 * 64]) {
+    clearRefreshTable();
+    stack[0].computed[0] = false;
+    stack[0].computed[1] = false;
     simdBuffer = std::make_unique<uint8_t[]>(32 * HIDDEN_SIZE * sizeof(int16_t));
 }
 
 NNUE::~NNUE() = default;
 
+// Only the live part of the stack is copied; the refresh cache starts empty
 NNUE::NNUE(const NNUE& other) : 
-    featureWeights(other.featureWeights),
-    outputWeights(other.outputWeights),
-    outputBias(other.outputBias),
-    accumulator(other.accumulator),
-    accumulatorStack(other.accumulatorStack),
-    accumulatorStackSize(other.accumulatorStackSize) {
+    weights(other.weights),
+    stack(new Accumulator[STACK_SIZE]),
+    stackTop(other.stackTop),
+    refreshTable(new RefreshEntry[2 * 64]) {
+    std::copy(other.stack.get(), other.stack.get() + stackTop + 1, stack.get());
+    clearRefreshTable();
     simdBuffer = std::make_unique<uint8_t[]>(32 * HIDDEN_SIZE * sizeof(int16_t));
     std::copy(
         other.simdBuffer.get(),
@@ -30,12 +40,10 @@ NNUE::NNUE(const NNUE& other) :
 
 NNUE& NNUE::operator=(const NNUE& other) {
     if (this != &other) {
-        featureWeights = other.featureWeights;
-        outputWeights = other.outputWeights;
-        outputBias = other.outputBias;
-        accumulator = other.accumulator;
-        accumulatorStack = other.accumulatorStack;
-        accumulatorStackSize = other.accumulatorStackSize;
+        weights = other.weights;
+        stackTop = other.stackTop;
+        std::copy(other.stack.get(), other.stack.get() + stackTop + 1, stack.get());
+        clearRefreshTable();
         
         simdBuffer = std::make_unique<uint8_t[]>(32 * HIDDEN_SIZE * sizeof(int16_t));
         std::copy(
@@ -48,23 +56,19 @@ NNUE& NNUE::operator=(const NNUE& other) {
 }
 
 NNUE::NNUE(NNUE&& other) noexcept :
-    featureWeights(std::move(other.featureWeights)),
-    outputWeights(std::move(other.outputWeights)),
-    outputBias(other.outputBias),
-    accumulator(std::move(other.accumulator)),
-    accumulatorStack(std::move(other.accumulatorStack)),
-    accumulatorStackSize(other.accumulatorStackSize),
+    weights(std::move(other.weights)),
+    stack(std::move(other.stack)),
+    stackTop(other.stackTop),
+    refreshTable(std::move(other.refreshTable)),
     simdBuffer(std::move(other.simdBuffer)) {
 }
 
 NNUE& NNUE::operator=(NNUE&& other) noexcept {
     if (this != &other) {
-        featureWeights = std::move(other.featureWeights);
-        outputWeights = std::move(other.outputWeights);
-        outputBias = other.outputBias;
-        accumulator = std::move(other.accumulator);
-        accumulatorStack = std::move(other.accumulatorStack);
-        accumulatorStackSize = other.accumulatorStackSize;
+        weights = std::move(other.weights);
+        stack = std::move(other.stack);
+        stackTop = other.stackTop;
+        refreshTable = std::move(other.refreshTable);
         simdBuffer = std::move(other.simdBuffer);
     }
     return *this;
@@ -74,153 +78,224 @@ void NNUE::loadWeights(const std::string& filename) {
     std::ifstream file(filename, std::ios::binary);
     if (!file) return;
 
-    uint32_t numFeatures;
+    auto loaded = std::make_shared<Weights>();
+    
+    // A network for other inputs would be indexed out of bounds
+    uint32_t numFeatures = 0;
     file.read(reinterpret_cast<char*>(&numFeatures), sizeof(numFeatures));
+    if (numFeatures != INPUT_SIZE) return;
     
-    featureWeights.resize(numFeatures);
-    for (auto& weights : featureWeights) {
-        file.read(reinterpret_cast<char*>(weights.weights.data()), 
+    loaded->featureWeights.resize(numFeatures);
+    for (auto& feature : loaded->featureWeights) {
+        file.read(reinterpret_cast<char*>(feature.weights.data()), 
                  HIDDEN_SIZE * sizeof(int16_t));
-        file.read(reinterpret_cast<char*>(&weights.bias), sizeof(int16_t));
+        file.read(reinterpret_cast<char*>(&feature.bias), sizeof(int16_t));
     }
     
-    file.read(reinterpret_cast<char*>(outputWeights.data()), 
+    file.read(reinterpret_cast<char*>(loaded->outputWeights.data()), 
               HIDDEN_SIZE * sizeof(int16_t));
-    file.read(reinterpret_cast<char*>(&outputBias), sizeof(int16_t));
+    file.read(reinterpret_cast<char*>(&loaded->outputBias), sizeof(int16_t));
+    if (!file) return;
+    
+    weights = std::move(loaded);
+    clearRefreshTable();
+}
+
+void NNUE::replicateWeights() {
+    if (weights) {
+        weights = std::make_shared<const Weights>(*weights);
+    }
 }
 
 void NNUE::refreshAccumulator(const Board& board) {
-    accumulator[0].computed = false;
-    accumulator[1].computed = false;
-    initializeAccumulator(board, true);
-    initializeAccumulator(board, false);
+    stackTop = 0;
+    stack[0].computed[0] = false;
+    stack[0].computed[1] = false;
+    if(isLoaded()) {
+        initializeAccumulator(board, true);
+        initializeAccumulator(board, false);
+    }
 }
 
-void NNUE::updateAccumulator(const Board& board, const Move& move) {
-    Piece movedPiece = board.getPiece(move.fromX, move.fromY);
-    Piece capturedPiece = board.getPiece(move.toX, move.toY);
-    
-    int fromSquare = move.fromY * 8 + move.fromX;
-    int toSquare = move.toY * 8 + move.toX;
-    
-    for(bool perspective : {true, false}) {
-        if(!accumulator[perspective].computed) continue;
-        
-        int kingSquare = accumulator[perspective].kingSquare;
-        int fromIdx = getFeatureIndex(movedPiece, fromSquare, kingSquare, perspective);
-        int toIdx = getFeatureIndex(movedPiece, toSquare, kingSquare, perspective);
-        
-        for(int i = 0; i < HIDDEN_SIZE / 16; ++i) {
-            vec_type acc = VectorOps::load(accumulator[perspective].values.data() + i * 16);
-            vec_type fromW = VectorOps::load(featureWeights[fromIdx].weights.data() + i * 16);
-            vec_type toW = VectorOps::load(featureWeights[toIdx].weights.data() + i * 16);
-            
-            acc = VectorOps::sub(acc, fromW);
-            acc = VectorOps::add(acc, toW);
-            
-            if(capturedPiece.getType() != EMPTY) {
-                int capturedIdx = getFeatureIndex(capturedPiece, toSquare, kingSquare, perspective);
-                vec_type capturedW = VectorOps::load(featureWeights[capturedIdx].weights.data() + i * 16);
-                acc = VectorOps::sub(acc, capturedW);
-            }
-            
-            VectorOps::store(accumulator[perspective].values.data() + i * 16, acc);
-        }
+void NNUE::pushAccumulator(const Board& board, Move move) {
+    assert(stackTop + 1 < STACK_SIZE);
+    Accumulator& next = stack[++stackTop];
+    next.computed[0] = false;
+    next.computed[1] = false;
+
+    int from = move.getFrom();
+    int to = move.getTo();
+    Piece moved = board.getPiece(from);
+    next.kingMoved[0] = moved.getType() == KING && moved.getColor() == BLACK;
+    next.kingMoved[1] = moved.getType() == KING && moved.getColor() == WHITE;
+
+    DirtyPieces& dirty = next.dirty;
+    dirty.count = 1;
+    dirty.piece[0] = moved;
+    dirty.from[0] = static_cast<uint8_t>(from);
+    dirty.to[0] = static_cast<uint8_t>(to);
+
+    // The king's own perspective is refreshed; the other one sees the rook move
+    if(move.getFlag() == CASTLING) {
+        bool kingSide = to > from;
+        dirty.piece[1] = Piece(ROOK, moved.getColor());
+        dirty.from[1] = static_cast<uint8_t>(kingSide ? from + 3 : from - 4);
+        dirty.to[1] = static_cast<uint8_t>(kingSide ? from + 1 : from - 1);
+        dirty.count = 2;
+        return;
+    }
+
+    if(move.getFlag() == PROMOTION) {
+        dirty.to[0] = NO_SQUARE;
+        dirty.piece[1] = Piece(move.getPromotion(), moved.getColor());
+        dirty.from[1] = NO_SQUARE;
+        dirty.to[1] = static_cast<uint8_t>(to);
+        dirty.count = 2;
+    }
+
+    // An en passant victim stands beside the pawn's origin, behind to
+    int captureSquare = move.getFlag() == EN_PASSANT ? to ^ 8 : to;
+    Piece captured = board.getPiece(captureSquare);
+    if(captured.getType() != EMPTY) {
+        dirty.piece[dirty.count] = captured;
+        dirty.from[dirty.count] = static_cast<uint8_t>(captureSquare);
+        dirty.to[dirty.count] = NO_SQUARE;
+        dirty.count++;
     }
 }
 
-void NNUE::pushAccumulator() {
-    if(accumulatorStackSize < 32) {
-        accumulatorStack[accumulatorStackSize] = accumulator[0];
-        accumulatorStack[accumulatorStackSize + 1] = accumulator[1];
-        accumulatorStackSize += 2;
+// Walks back to the nearest ply where the perspective is computed and
+// replays the moves since. A king move on the way changes every feature,
+// so the position is then built from scratch instead.
+void NNUE::updateAccumulator(const Board& board, bool perspective) {
+    int ply = stackTop;
+    while(!stack[ply].computed[perspective]) {
+        if(ply == 0 || stack[ply].kingMoved[perspective]) {
+            initializeAccumulator(board, perspective);
+            return;
+        }
+        ply--;
+    }
+
+    int kingSquare = board.getKingSquare(perspective ? WHITE : BLACK);
+    for(; ply < stackTop; ply++) {
+        applyDirtyPieces(stack[ply], stack[ply + 1], kingSquare, perspective);
+        stack[ply + 1].computed[perspective] = true;
     }
 }
 
-void NNUE::popAccumulator() {
-    if(accumulatorStackSize >= 2) {
-        accumulatorStackSize -= 2;
-        accumulator[0] = accumulatorStack[accumulatorStackSize];
-        accumulator[1] = accumulatorStack[accumulatorStackSize + 1];
+void NNUE::applyDirtyPieces(const Accumulator& previous, Accumulator& next, int kingSquare, bool perspective) {
+    // Kings are not features: their own side's king is the bucket
+    int removed[3];
+    int added[3];
+    int removedCount = 0;
+    int addedCount = 0;
+    const DirtyPieces& dirty = next.dirty;
+    for(int i = 0; i < dirty.count; i++) {
+        if(dirty.piece[i].getType() == KING) continue;
+        if(dirty.from[i] != NO_SQUARE) {
+            removed[removedCount++] = getFeatureIndex(dirty.piece[i], dirty.from[i], kingSquare, perspective);
+        }
+        if(dirty.to[i] != NO_SQUARE) {
+            added[addedCount++] = getFeatureIndex(dirty.piece[i], dirty.to[i], kingSquare, perspective);
+        }
+    }
+
+    const int16_t* source = previous.values[perspective].data();
+    int16_t* target = next.values[perspective].data();
+    for(int i = 0; i < HIDDEN_SIZE / LANES; ++i) {
+        vec_type acc = VectorOps::load(source + i * LANES);
+        for(int j = 0; j < removedCount; j++) {
+            acc = VectorOps::sub(acc, VectorOps::load(weights->featureWeights[removed[j]].weights.data() + i * LANES));
+        }
+        for(int j = 0; j < addedCount; j++) {
+            acc = VectorOps::add(acc, VectorOps::load(weights->featureWeights[added[j]].weights.data() + i * LANES));
+        }
+        VectorOps::store(target + i * LANES, acc);
     }
 }
 
+// The accumulator holds raw sums; the clipped ReLU is applied here so that
+// it can be updated incrementally
 int NNUE::evaluate(const Board& board, bool perspective) {
-    if(!accumulator[perspective].computed) {
-        initializeAccumulator(board, perspective);
+    if(!stack[stackTop].computed[perspective]) {
+        updateAccumulator(board, perspective);
     }
     
+    const int16_t* values = stack[stackTop].values[perspective].data();
     int32_t finalSum = 0;
-    for(int i = 0; i < HIDDEN_SIZE / 16; ++i) {
-        vec_type acc = VectorOps::load(accumulator[perspective].values.data() + i * 16);
-        vec_type weight = VectorOps::load(outputWeights.data() + i * 16);
+    for(int i = 0; i < HIDDEN_SIZE / LANES; ++i) {
+        vec_type acc = VectorOps::max(VectorOps::load(values + i * LANES), VectorOps::zero());
+        vec_type weight = VectorOps::load(weights->outputWeights.data() + i * LANES);
         vec_type prod = VectorOps::mul(acc, weight);
         finalSum += VectorOps::horizontal_add(prod);
     }
     
-    finalSum = finalSum / 64 + outputBias;
+    finalSum = finalSum / 64 + weights->outputBias;
     return perspective ? finalSum : -finalSum;
 }
 
-int16_t NNUE::clamp(int32_t x) {
-    return static_cast<int16_t>(std::max<int32_t>(-32768, std::min<int32_t>(32767, x)));
-}
-
+// Ten piece kinds (no kings) on 64 squares per king bucket
 int NNUE::getFeatureIndex(const Piece& piece, int square, int kingSquare, bool perspective) const {
     if(!perspective) {
         square = 63 - square;
         kingSquare = 63 - kingSquare;
     }
     
-    int pieceIndex = piece.getType() * 2 + (piece.getColor() == WHITE ? 0 : 1);
+    int pieceIndex = (piece.getType() - PAWN) * 2 + (piece.getColor() == WHITE ? 0 : 1);
     return kingSquare * INPUTS_PER_KING + pieceIndex * 64 + square;
 }
 
-void NNUE::initializeAccumulator(const Board& board, bool perspective) {
-    std::fill(accumulator[perspective].values.begin(), 
-              accumulator[perspective].values.end(), 0);
-              
-    int kingSquare = -1;
-    for(int y = 0; y < 8 && kingSquare == -1; ++y) {
-        for(int x = 0; x < 8 && kingSquare == -1; ++x) {
-            Piece piece = board.getPiece(x, y);
-            if(piece.getType() == KING && piece.getColor() == (perspective ? WHITE : BLACK)) {
-                kingSquare = y * 8 + x;
-            }
+// Empty entries stand for an empty board, whose accumulator is zero
+void NNUE::clearRefreshTable() {
+    for(int i = 0; i < 2 * 64; i++) {
+        refreshTable[i].values.fill(0);
+        for(auto& byType : refreshTable[i].pieces) {
+            std::fill(std::begin(byType), std::end(byType), 0);
         }
     }
+}
+
+// Brings the cached accumulator for this king square to the board, then
+// copies it to the top of the stack
+void NNUE::initializeAccumulator(const Board& board, bool perspective) {
+    int kingSquare = board.getKingSquare(perspective ? WHITE : BLACK);
+    RefreshEntry& entry = refreshTable[perspective * 64 + kingSquare];
     
-    accumulator[perspective].kingSquare = kingSquare;
-    
-    for(int y = 0; y < 8; ++y) {
-        for(int x = 0; x < 8; ++x) {
-            Piece piece = board.getPiece(x, y);
-            if(piece.getType() != EMPTY) {
-                int square = y * 8 + x;
-                int featureIndex = getFeatureIndex(piece, square, kingSquare, perspective);
-                
-                for(int i = 0; i < HIDDEN_SIZE / 16; ++i) {
-                    vec_type acc = VectorOps::load(accumulator[perspective].values.data() + i * 16);
-                    vec_type weight = VectorOps::load(featureWeights[featureIndex].weights.data() + i * 16);
-                    acc = VectorOps::add(acc, weight);
-                    VectorOps::store(accumulator[perspective].values.data() + i * 16, acc);
-                }
+    int removed[32];
+    int added[32];
+    int removedCount = 0;
+    int addedCount = 0;
+    for(Color color : {WHITE, BLACK}) {
+        for(int type = PAWN; type < KING; type++) {
+            Piece piece(static_cast<PieceType>(type), color);
+            Bitboard now = board.getPieces(static_cast<PieceType>(type), color);
+            Bitboard gone = entry.pieces[color][type] & ~now;
+            Bitboard arrived = now & ~entry.pieces[color][type];
+            while(gone) {
+                removed[removedCount++] = getFeatureIndex(piece, popLsb(gone), kingSquare, perspective);
+            }
+            while(arrived) {
+                added[addedCount++] = getFeatureIndex(piece, popLsb(arrived), kingSquare, perspective);
             }
+            entry.pieces[color][type] = now;
         }
     }
     
-    applyBatchActivation(accumulator[perspective].values.data(), HIDDEN_SIZE);
-    accumulator[perspective].computed = true;
-}
-
-void NNUE::applyBatchActivation(int16_t* values, size_t size) {
-    for(size_t i = 0; i < size / 16; ++i) {
-        vec_type val = VectorOps::load(values + i * 16);
-        vec_type zero = VectorOps::zero();
-        vec_type max_val = VectorOps::set1(32767);
-        val = VectorOps::min(VectorOps::max(val, zero), max_val);
-        VectorOps::store(values + i * 16, val);
+    int16_t* values = stack[stackTop].values[perspective].data();
+    for(int i = 0; i < HIDDEN_SIZE / LANES; ++i) {
+        vec_type acc = VectorOps::load(entry.values.data() + i * LANES);
+        for(int j = 0; j < removedCount; j++) {
+            acc = VectorOps::sub(acc, VectorOps::load(weights->featureWeights[removed[j]].weights.data() + i * LANES));
+        }
+        for(int j = 0; j < addedCount; j++) {
+            acc = VectorOps::add(acc, VectorOps::load(weights->featureWeights[added[j]].weights.data() + i * LANES));
+        }
+        VectorOps::store(entry.values.data() + i * LANES, acc);
+        VectorOps::store(values + i * LANES, acc);
     }
+    
+    stack[stackTop].computed[perspective] = true;
 }
 
 simd::vec_type* NNUE::getSIMDBuffer() {
@@ -0,0 +1,133 @@
+#include "../include/numa.h"
+#include <algorithm>
+#include <fstream>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <sched.h>
+#endif
+
+namespace Numa {
+
+namespace {
+
+// Logical processors per node. On Windows a processor is numbered
+// group * 64 + bit, so a node's processors all share one group.
+std::vector<std::vector<int>> detectNodes() {
+    std::vector<std::vector<int>> nodes;
+#if defined(_WIN32)
+    ULONG highest = 0;
+    if(GetNumaHighestNodeNumber(&highest)) {
+        for(USHORT node = 0; node <= highest; node++) {
+            GROUP_AFFINITY affinity;
+            if(!GetNumaNodeProcessorMaskEx(node, &affinity)) continue;
+            std::vector<int> cpus;
+            for(int bit = 0; bit < 64; bit++) {
+                if(affinity.Mask & (KAFFINITY(1) << bit)) {
+                    cpus.push_back(affinity.Group * 64 + bit);
+                }
+            }
+            if(!cpus.empty()) nodes.push_back(cpus);
+        }
+    }
+#elif defined(__linux__)
+    // cpulist holds ranges such as "0-15,32-47"
+    for(int node = 0;; node++) {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if(!file) break;
+        std::vector<int> cpus;
+        std::string range;
+        while(std::getline(file, range, ',')) {
+            size_t dash = range.find('-');
+            try {
+                int first = std::stoi(range);
+                int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+                for(int cpu = first; cpu <= last; cpu++) {
+                    cpus.push_back(cpu);
+                }
+            } catch(...) {
+            }
+        }
+        if(!cpus.empty()) nodes.push_back(cpus);
+    }
+#endif
+    return nodes;
+}
+
+const std::vector<std::vector<int>>& nodes() {
+    static const std::vector<std::vector<int>> detected = detectNodes();
+    return detected;
+}
+
+} // namespace
+
+Policy parsePolicy(const std::string& name) {
+    if(name == "none") return POLICY_NONE;
+    if(name == "bind") return POLICY_BIND;
+    return POLICY_AUTO;
+}
+
+int nodeCount() {
+    return std::max<int>(1, static_cast<int>(nodes().size()));
+}
+
+int cpuCount(int node) {
+    if(node < 0 || node >= static_cast<int>(nodes().size())) return 0;
+    return static_cast<int>(nodes()[node].size());
+}
+
+std::vector<int> assignNodes(Policy policy, int threadCount) {
+    std::vector<int> assigned;
+    if(policy == POLICY_NONE || nodes().empty()) return assigned;
+
+    int largest = 0;
+    int total = 0;
+    for(const std::vector<int>& cpus : nodes()) {
+        largest = std::max(largest, static_cast<int>(cpus.size()));
+        total += static_cast<int>(cpus.size());
+    }
+    if(policy == POLICY_AUTO && (nodes().size() < 2 || threadCount <= largest)) {
+        return assigned;
+    }
+
+    // One thread per processor, node by node, wrapping around once every
+    // processor has one; the main thread stays on the first node
+    for(int i = 0; i < threadCount; i++) {
+        int slot = i % total;
+        int node = 0;
+        while(slot >= static_cast<int>(nodes()[node].size())) {
+            slot -= static_cast<int>(nodes()[node].size());
+            node++;
+        }
+        assigned.push_back(node);
+    }
+    return assigned;
+}
+
+void bindThisThread(int node) {
+    if(node < 0 || node >= static_cast<int>(nodes().size())) return;
+    const std::vector<int>& cpus = nodes()[node];
+#if defined(_WIN32)
+    GROUP_AFFINITY affinity = {};
+    affinity.Group = static_cast<WORD>(cpus[0] / 64);
+    for(int cpu : cpus) {
+        affinity.Mask |= KAFFINITY(1) << (cpu % 64);
+    }
+    SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr);
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(int cpu : cpus) {
+        if(cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+    }
+    sched_setaffinity(0, sizeof(set), &set);
+#else
+    (void)cpus;
+#endif
+}
+
+}
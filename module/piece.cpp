@@ -1,20 +1,8 @@
 #include "../include/piece.h"
 #include <cstdlib>
 
-Piece::Piece() : type(EMPTY), color(WHITE) {}
-
-Piece::Piece(PieceType t, Color c) : type(t), color(c) {}
-
-PieceType Piece::getType() const {
-    return type;
-}
-
-Color Piece::getColor() const {
-    return color;
-}
-
 int Piece::getValue() const {
-    switch(type) {
+    switch(getType()) {
         case PAWN: return 100;
         case KNIGHT: return 320;
         case BISHOP: return 330;
@@ -0,0 +1,37 @@
+#include "../include/timeman.h"
+#include <algorithm>
+
+namespace {
+    // Sudden-death games are budgeted as if this many moves remained
+    constexpr int MOVE_HORIZON = 40;
+}
+
+void TimeManager::init(const SearchLimits& limits, Color us, int moveOverhead) {
+    start = std::chrono::steady_clock::now();
+    enabled = limits.usesClock() && !limits.infinite;
+    if(!enabled) return;
+
+    if(limits.movetime >= 0) {
+        optimumTime = maximumTime = std::max<int64_t>(1, limits.movetime - moveOverhead);
+        return;
+    }
+
+    int64_t time = std::max(0, us == WHITE ? limits.wtime : limits.btime);
+    int64_t inc = us == WHITE ? limits.winc : limits.binc;
+    int movesToGo = limits.movestogo > 0 ? std::min(limits.movestogo, MOVE_HORIZON) : MOVE_HORIZON;
+
+    // What is left for the next movesToGo moves once every move has paid
+    // the overhead, with a couple of moves' overhead kept in reserve
+    int64_t timeLeft = std::max<int64_t>(1, time + inc * (movesToGo - 1) - moveOverhead * (2 + movesToGo));
+
+    optimumTime = timeLeft / movesToGo;
+    // Never plan to spend more than 80% of what is on the clock
+    maximumTime = std::min<int64_t>(optimumTime * 3, time * 8 / 10 - moveOverhead);
+    maximumTime = std::max<int64_t>(1, maximumTime);
+    optimumTime = std::max<int64_t>(1, std::min(optimumTime, maximumTime));
+}
+
+int64_t TimeManager::elapsed() const {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
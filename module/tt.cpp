@@ -0,0 +1,357 @@
+#include "../include/tt.h"
+#include "../include/numa.h"
+#include "../include/zobrist.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace {
+
+// Maps the key uniformly onto [0, count) without needing a power of two
+inline uint64_t mulHi64(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+    return static_cast<uint64_t>((static_cast<unsigned __int128>(a) * b) >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    return __umulh(a, b);
+#else
+    uint64_t aLo = a & 0xFFFFFFFF, aHi = a >> 32;
+    uint64_t bLo = b & 0xFFFFFFFF, bHi = b >> 32;
+    uint64_t mid = aHi * bLo + ((aLo * bLo) >> 32);
+    uint64_t mid2 = aLo * bHi + (mid & 0xFFFFFFFF);
+    return aHi * bHi + (mid >> 32) + (mid2 >> 32);
+#endif
+}
+
+// The generation lives in the top five bits; adding a full cycle keeps the
+// bound bits from borrowing when ages are subtracted
+constexpr uint8_t GENERATION_MASK = 0xF8;
+constexpr int GENERATION_CYCLE = 255 + 8;
+
+constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+// Tries the allocation strategies from best to worst; size is a multiple
+// of HUGE_PAGE_SIZE
+void* allocateTable(size_t size, PageKind& kind) {
+#if defined(_WIN32)
+    // Needs the "Lock pages in memory" privilege, which is rarely granted
+    SIZE_T largePage = GetLargePageMinimum();
+    if(largePage && size % largePage == 0) {
+        void* memory = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        if(memory) {
+            kind = PAGES_HUGETLB;
+            return memory;
+        }
+    }
+    kind = PAGES_SMALL;
+    return _aligned_malloc(size, HUGE_PAGE_SIZE);
+#else
+#if defined(__linux__) && defined(MAP_HUGETLB)
+    // Succeeds only with pages reserved through vm.nr_hugepages
+    void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(mapped != MAP_FAILED) {
+        kind = PAGES_HUGETLB;
+        return mapped;
+    }
+#endif
+    void* memory = nullptr;
+    if(posix_memalign(&memory, HUGE_PAGE_SIZE, size)) {
+        return nullptr;
+    }
+    kind = PAGES_SMALL;
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if(!madvise(memory, size, MADV_HUGEPAGE)) {
+        kind = PAGES_TRANSPARENT;
+    }
+#endif
+    return memory;
+#endif
+}
+
+void freeTable(void* memory, size_t size, PageKind kind) {
+#if defined(_WIN32)
+    (void)size;
+    if(kind == PAGES_HUGETLB) {
+        VirtualFree(memory, 0, MEM_RELEASE);
+    } else {
+        _aligned_free(memory);
+    }
+#else
+#if defined(__linux__)
+    if(kind == PAGES_HUGETLB) {
+        munmap(memory, size);
+        return;
+    }
+#endif
+    (void)size;
+    (void)kind;
+    std::free(memory);
+#endif
+}
+
+// Bytes of the mapping around address that the kernel has backed with
+// transparent huge pages, from /proc/self/smaps
+size_t transparentHugeBytes(const void* address) {
+    size_t bytes = 0;
+#if defined(__linux__)
+    std::ifstream smaps("/proc/self/smaps");
+    uintptr_t target = reinterpret_cast<uintptr_t>(address);
+    bool inside = false;
+    std::string line;
+    while(std::getline(smaps, line)) {
+        unsigned long long begin, end;
+        if(std::sscanf(line.c_str(), "%llx-%llx ", &begin, &end) == 2 && line.find(':') > line.find(' ')) {
+            inside = target >= begin && target < end;
+        } else if(inside && line.compare(0, 14, "AnonHugePages:") == 0) {
+            bytes += std::strtoull(line.c_str() + 14, nullptr, 10) * 1024;
+        }
+    }
+#else
+    (void)address;
+#endif
+    return bytes;
+}
+
+// Snapshot header. The magic doubles as a byte order check and the key
+// check catches a change of Zobrist keys, which would make every stored
+// fragment meaningless.
+constexpr uint64_t SNAPSHOT_MAGIC = 0x3154545153504453ULL;
+constexpr uint32_t SNAPSHOT_VERSION = 2;
+constexpr size_t SNAPSHOT_CHUNK = 64 * 1024 * 1024;
+
+struct SnapshotHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t clusterSize;
+    uint64_t megabytes;
+    uint64_t clusterCount;
+    uint64_t keyCheck;
+    uint8_t generation;
+    uint8_t padding[7];
+};
+
+uint64_t keyCheck() {
+    const Zobrist::Keys& keys = Zobrist::keys;
+    return keys.psq[WHITE][PAWN][8] ^ keys.psq[BLACK][KING][63] ^ keys.castling[15]
+         ^ keys.enPassant[7] ^ keys.side ^ keys.noPawns;
+}
+
+} // namespace
+
+void TTEntry::save(uint64_t key, int score, int eval, Bound bound, int depth, Move move, uint8_t generation) {
+    uint16_t fragment = static_cast<uint16_t>(key);
+
+    // Keep the old move when this search found none for the same position
+    if(!move.isNull() || fragment != key16) {
+        this->move = move.getRaw();
+    }
+
+    // Shallow results do not push out deeper ones for the same position
+    // unless they are exact or left over from an earlier search
+    if(bound == BOUND_EXACT || fragment != key16 || depth + DEPTH_OFFSET + 4 > depth8
+       || (genBound8 & GENERATION_MASK) != generation) {
+        key16 = fragment;
+        this->score = static_cast<int16_t>(score);
+        this->eval = static_cast<int16_t>(eval);
+        depth8 = static_cast<uint8_t>(depth + DEPTH_OFFSET);
+        genBound8 = static_cast<uint8_t>(generation | bound);
+    }
+}
+
+void TranspositionTable::release() {
+    if(table) {
+        freeTable(table, allocatedBytes, pageKind);
+    }
+    table = nullptr;
+    clusterCount = 0;
+    allocatedBytes = 0;
+}
+
+void TranspositionTable::resize(size_t megabytes) {
+    release();
+    sizeMB = megabytes;
+    clusterCount = megabytes * 1024 * 1024 / sizeof(Cluster);
+    allocatedBytes = (clusterCount * sizeof(Cluster) + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    table = static_cast<Cluster*>(allocateTable(allocatedBytes, pageKind));
+    if(!table) {
+        std::cerr << "info string failed to allocate " << megabytes << " MB for the hash table" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    clear();
+}
+
+void TranspositionTable::clear() {
+    // Each thread zeroes a contiguous slice. When the search threads are
+    // bound, slice i is cleared on thread i's node, so first touch spreads
+    // the pages over the nodes in the same proportion as the threads.
+    size_t bytes = clusterCount * sizeof(Cluster);
+    int threads = static_cast<int>(std::min<size_t>(threadCount, bytes / HUGE_PAGE_SIZE + 1));
+    bool bind = static_cast<int>(threadNodes.size()) >= threads;
+    char* memory = reinterpret_cast<char*>(table);
+    auto zero = [this, memory, bytes, threads, bind](int i) {
+        if(bind) {
+            Numa::bindThisThread(threadNodes[i]);
+        }
+        size_t begin = bytes / threads * i;
+        size_t end = i == threads - 1 ? bytes : bytes / threads * (i + 1);
+        std::memset(memory + begin, 0, end - begin);
+    };
+
+    // The calling thread only takes a slice when it need not be bound
+    std::vector<std::thread> workers;
+    for(int i = bind ? 0 : 1; i < threads; i++) {
+        workers.emplace_back(zero, i);
+    }
+    if(!bind) {
+        zero(0);
+    }
+    for(std::thread& worker : workers) {
+        worker.join();
+    }
+    generation8 = 0;
+}
+
+std::string TranspositionTable::pageDescription() const {
+    switch(pageKind) {
+        case PAGES_HUGETLB:
+            return "huge pages";
+        case PAGES_TRANSPARENT: {
+            size_t huge = transparentHugeBytes(table);
+            if(!huge) return "4 KB pages (transparent huge pages unavailable)";
+            return "transparent huge pages for " + std::to_string(huge / (1024 * 1024)) + " of "
+                 + std::to_string(allocatedBytes / (1024 * 1024)) + " MB";
+        }
+        default:
+            return "4 KB pages";
+    }
+}
+
+TranspositionTable::Cluster* TranspositionTable::clusterFor(uint64_t key) const {
+    return &table[mulHi64(key, clusterCount)];
+}
+
+TTEntry* TranspositionTable::probe(uint64_t key, bool& found) const {
+    TTEntry* entries = clusterFor(key)->entry;
+    uint16_t fragment = static_cast<uint16_t>(key);
+
+    for(int i = 0; i < CLUSTER_SIZE; i++) {
+        if(entries[i].key16 == fragment || !entries[i].depth8) {
+            found = entries[i].depth8 != 0;
+            return &entries[i];
+        }
+    }
+
+    // Replace the slot whose depth, less eight plies per generation of
+    // age, is lowest
+    auto worth = [this](const TTEntry& e) {
+        int age = ((GENERATION_CYCLE + generation8 - e.genBound8) & GENERATION_MASK) / 8;
+        return e.depth8 - 8 * age;
+    };
+    TTEntry* replace = &entries[0];
+    for(int i = 1; i < CLUSTER_SIZE; i++) {
+        if(worth(entries[i]) < worth(*replace)) {
+            replace = &entries[i];
+        }
+    }
+    found = false;
+    return replace;
+}
+
+void TranspositionTable::prefetch(uint64_t key) const {
+#if defined(__GNUC__)
+    __builtin_prefetch(clusterFor(key));
+#elif defined(_MSC_VER)
+    _mm_prefetch(reinterpret_cast<const char*>(clusterFor(key)), _MM_HINT_T0);
+#endif
+}
+
+int TranspositionTable::hashfull() const {
+    int used = 0;
+    size_t sample = clusterCount < 1000 ? clusterCount : 1000;
+    for(size_t i = 0; i < sample; i++) {
+        for(int j = 0; j < CLUSTER_SIZE; j++) {
+            const TTEntry& e = table[i].entry[j];
+            used += e.depth8 && (e.genBound8 & GENERATION_MASK) == generation8;
+        }
+    }
+    return sample ? static_cast<int>(used * 1000 / (sample * CLUSTER_SIZE)) : 0;
+}
+
+bool TranspositionTable::save(const std::string& filename) const {
+    FILE* file = std::fopen(filename.c_str(), "wb");
+    if(!file) return false;
+
+    SnapshotHeader header{};
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.clusterSize = sizeof(Cluster);
+    header.megabytes = sizeMB;
+    header.clusterCount = clusterCount;
+    header.keyCheck = keyCheck();
+    header.generation = generation8;
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+
+    const char* data = reinterpret_cast<const char*>(table);
+    size_t total = clusterCount * sizeof(Cluster);
+    for(size_t done = 0; ok && done < total; done += SNAPSHOT_CHUNK) {
+        size_t length = std::min(SNAPSHOT_CHUNK, total - done);
+        ok = std::fwrite(data + done, 1, length, file) == length;
+    }
+    return std::fclose(file) == 0 && ok;
+}
+
+size_t TranspositionTable::load(const std::string& filename) {
+    FILE* file = std::fopen(filename.c_str(), "rb");
+    if(!file) return 0;
+
+    SnapshotHeader header;
+    if(std::fread(&header, sizeof(header), 1, file) != 1 || header.magic != SNAPSHOT_MAGIC
+       || header.version != SNAPSHOT_VERSION || header.clusterSize != sizeof(Cluster)
+       || header.keyCheck != keyCheck() || header.megabytes < static_cast<size_t>(MIN_SIZE_MB)
+       || header.megabytes > static_cast<size_t>(MAX_SIZE_MB)) {
+        std::fclose(file);
+        return 0;
+    }
+
+    if(header.megabytes != sizeMB) {
+        resize(header.megabytes);
+    }
+    if(header.clusterCount != clusterCount) {
+        std::fclose(file);
+        return 0;
+    }
+
+    char* data = reinterpret_cast<char*>(table);
+    size_t total = clusterCount * sizeof(Cluster);
+    bool ok = true;
+    for(size_t done = 0; ok && done < total; done += SNAPSHOT_CHUNK) {
+        size_t length = std::min(SNAPSHOT_CHUNK, total - done);
+        ok = std::fread(data + done, 1, length, file) == length;
+    }
+    std::fclose(file);
+
+    // A short file leaves a half-written table, which is worse than none
+    if(!ok) {
+        clear();
+        return 0;
+    }
+    generation8 = header.generation;
+    return sizeMB;
+}
@@ -1,16 +1,27 @@
 #include "../include/uci.h"
+#include "../include/movegen.h"
 #include <sstream>
 #include <iostream>
 #include <thread>
 #include <chrono>
 
-UCI::UCI() : running(true), engine(6) {}
+UCI::UCI() : running(true), debugMode(false), engine(6), hashFile("hash.dsq") {}
 
 void UCI::start() {
     std::string line;
     while(running && std::getline(std::cin, line)) {
         processCommand(line);
     }
+    engine.stopSearching();
+    waitForSearch();
+}
+
+// The engine's helper threads must not be torn down mid-search, so the
+// search thread is joined rather than detached
+void UCI::waitForSearch() {
+    if(searchThread.joinable()) {
+        searchThread.join();
+    }
 }
 
 void UCI::processCommand(const std::string& cmd) {
@@ -22,15 +33,31 @@ void UCI::processCommand(const std::string& cmd) {
         std::cout << "id name DeepSquare" << std::endl;
         std::cout << "id author LabWorkShift" << std::endl;
         std::cout << "option name Hash type spin default 128 min 1 max 32768" << std::endl;
+        std::cout << "option name NeverClearHash type check default false" << std::endl;
+        std::cout << "option name HashFile type string default hash.dsq" << std::endl;
+        std::cout << "option name SaveHash type button" << std::endl;
+        std::cout << "option name LoadHash type button" << std::endl;
+        std::cout << "option name EvalCache type spin default 1 min 0 max 1024" << std::endl;
         std::cout << "option name Threads type spin default 1 min 1 max 512" << std::endl;
+        std::cout << "option name NumaPolicy type combo default auto var auto var none var bind" << std::endl;
         std::cout << "option name MultiPV type spin default 1 min 1 max 500" << std::endl;
         std::cout << "option name Skill Level type spin default 20 min 0 max 20" << std::endl;
         std::cout << "option name Ponder type check default false" << std::endl;
+        std::cout << "option name Move Overhead type spin default 10 min 0 max 5000" << std::endl;
+        std::cout << "option name PerftHash type spin default 0 min 0 max 4096" << std::endl;
+        std::cout << "option name BookFile type string default <empty>" << std::endl;
+        std::cout << "option name BookBestMove type check default false" << std::endl;
+        std::cout << "option name BookDepth type spin default 255 min 1 max 255" << std::endl;
         std::cout << "uciok" << std::endl;
     }
     else if(token == "debug") {
         iss >> token;
         debugMode = (token == "on");
+        engine.setDebugMode(debugMode);
+        if(debugMode) {
+            std::cout << "info string slider attacks " << Bitboards::sliderIndexing()
+                      << " initialized in " << Bitboards::initMicros() << " us" << std::endl;
+        }
     }
     else if(token == "isready") {
         std::cout << "readyok" << std::endl;
@@ -53,11 +80,14 @@ void UCI::processCommand(const std::string& cmd) {
     }
     else if(token == "stop") {
         engine.stopSearching();
+        waitForSearch();
     }
     else if(token == "ponderhit") {
-        // Handle ponderhit
+        engine.ponderHit();
     }
     else if(token == "quit") {
+        engine.stopSearching();
+        waitForSearch();
         running = false;
     }
 }
@@ -114,13 +144,18 @@ void UCI::go(const std::string& cmd) {
     std::string token;
     iss >> token; // "go"
     
-    int wtime = -1, btime = -1, winc = 0, binc = 0;
-    int movestogo = 0, depth = -1, nodes = -1, mate = -1;
-    int movetime = -1;
-    bool infinite = false, ponder = false;
+    SearchLimits limits;
+    int mate = -1;
     
     while(iss >> token) {
-        if(token == "searchmoves") {
+        if(token == "perft") {
+            // Runs synchronously; the divide output ends with the node count
+            int perftDepth = 1;
+            iss >> perftDepth;
+            engine.divide(board, perftDepth);
+            return;
+        }
+        else if(token == "searchmoves") {
             // Handle searchmoves
             while(iss >> token) {
                 if(token == "ponder" || token == "wtime" || token == "btime" || 
@@ -132,49 +167,47 @@ void UCI::go(const std::string& cmd) {
                 // Add move to search moves list
             }
         }
-        else if(token == "ponder") ponder = true;
-        else if(token == "wtime") iss >> wtime;
-        else if(token == "btime") iss >> btime;
-        else if(token == "winc") iss >> winc;
-        else if(token == "binc") iss >> binc;
-        else if(token == "movestogo") iss >> movestogo;
-        else if(token == "depth") iss >> depth;
-        else if(token == "nodes") iss >> nodes;
+        else if(token == "ponder") limits.ponder = true;
+        else if(token == "wtime") iss >> limits.wtime;
+        else if(token == "btime") iss >> limits.btime;
+        else if(token == "winc") iss >> limits.winc;
+        else if(token == "binc") iss >> limits.binc;
+        else if(token == "movestogo") iss >> limits.movestogo;
+        else if(token == "depth") iss >> limits.depth;
+        else if(token == "nodes") iss >> limits.nodes;
         else if(token == "mate") iss >> mate;
-        else if(token == "movetime") iss >> movetime;
-        else if(token == "infinite") infinite = true;
+        else if(token == "movetime") iss >> limits.movetime;
+        else if(token == "infinite") limits.infinite = true;
     }
     
-    // Set search parameters
-    engine.setSearchParams(depth, movetime, wtime, btime, winc, binc);
+    // A book move is answered at once; while pondering or analysing the
+    // search has to run until stopped
+    if(!limits.ponder && !limits.infinite) {
+        Move bookMove = book.probe(board);
+        if(!bookMove.isNull()) {
+            waitForSearch();
+            std::cout << "bestmove " << moveToString(bookMove) << std::endl;
+            return;
+        }
+    }
+
+    // The previous search still reads the limits and the stop flag until
+    // it is joined
+    waitForSearch();
+    engine.setSearchParams(limits);
     
     // Start search in a separate thread
-    std::thread searchThread([this]() {
+    searchThread = std::thread([this]() {
         Move bestMove = engine.getBestMove(board);
         
-        // Output best move
-        std::cout << "bestmove " 
-                  << static_cast<char>('a' + bestMove.fromX)
-                  << static_cast<char>('1' + bestMove.fromY)
-                  << static_cast<char>('a' + bestMove.toX)
-                  << static_cast<char>('1' + bestMove.toY);
-        
-        // Add promotion piece if necessary
-        if(bestMove.promotion != EMPTY) {
-            char promotionChar = 'q';
-            switch(bestMove.promotion) {
-                case KNIGHT: promotionChar = 'n'; break;
-                case BISHOP: promotionChar = 'b'; break;
-                case ROOK: promotionChar = 'r'; break;
-                case QUEEN: promotionChar = 'q'; break;
-            }
-            std::cout << promotionChar;
+        // Output best move, with the reply to ponder on when there is one
+        std::cout << "bestmove " << moveToString(bestMove);
+        Move ponderMove = engine.getPonderMove();
+        if(!ponderMove.isNull()) {
+            std::cout << " ponder " << moveToString(ponderMove);
         }
-        
         std::cout << std::endl;
     });
-    
-    searchThread.detach();
 }
 
 void UCI::setOption(const std::string& cmd) {
@@ -201,10 +234,32 @@ void UCI::setOption(const std::string& cmd) {
         int hashSize = std::stoi(value);
         engine.setHashSize(hashSize);
     }
+    else if(name == "NeverClearHash") {
+        engine.setNeverClearHash(value == "true");
+    }
+    else if(name == "HashFile") {
+        hashFile = value;
+    }
+    else if(name == "SaveHash") {
+        bool saved = engine.saveHash(hashFile);
+        std::cout << "info string " << (saved ? "saved hash to " : "could not save hash to ")
+                  << hashFile << std::endl;
+    }
+    else if(name == "LoadHash") {
+        bool loaded = engine.loadHash(hashFile);
+        std::cout << "info string " << (loaded ? "loaded hash from " : "could not load hash from ")
+                  << hashFile << std::endl;
+    }
+    else if(name == "EvalCache") {
+        engine.setEvalCacheSize(std::stoi(value));
+    }
     else if(name == "Threads") {
         int threads = std::stoi(value);
         engine.setThreadCount(threads);
     }
+    else if(name == "NumaPolicy") {
+        engine.setNumaPolicy(value);
+    }
     else if(name == "MultiPV") {
         int multiPV = std::stoi(value);
         engine.setMultiPV(multiPV);
@@ -217,4 +272,44 @@ void UCI::setOption(const std::string& cmd) {
         bool ponderEnabled = (value == "true");
         engine.setPonder(ponderEnabled);
     }
-}
\ No newline at end of file
+    else if(name == "Move Overhead") {
+        engine.setMoveOverhead(std::stoi(value));
+    }
+    else if(name == "PerftHash") {
+        engine.setPerftHashSize(std::stoi(value));
+    }
+    else if(name == "BookFile") {
+        if(!book.open(value) && value != "<empty>" && !value.empty()) {
+            std::cout << "info string could not open book " << value << std::endl;
+        }
+    }
+    else if(name == "BookBestMove") {
+        book.setBestMove(value == "true");
+    }
+    else if(name == "BookDepth") {
+        book.setDepth(std::max(1, std::min(std::stoi(value), Book::MAX_DEPTH)));
+    }
+    else {
+        engine.setSearchParam(name, value);
+    }
+}
+
+std::string UCI::moveToString(const Move& move) {
+    return move.toString();
+}
+
+Move UCI::stringToMove(const std::string& moveStr) {
+    if(moveStr.length() < 4) {
+        return Move();
+    }
+    
+    // Match against the legal moves so the flags come out right
+    MoveList moves;
+    MoveGen::generate(LEGAL, board, moves);
+    for(Move move : moves) {
+        if(move.toString() == moveStr) {
+            return move;
+        }
+    }
+    return Move();
+}